@@ -0,0 +1,32 @@
+#include "arena.h"
+
+// Chunks are aligned for any type a ring may hold
+#define ARENA_ALIGN 16
+
+/* Sets up a pool of chunks of the given size in size bytes at mem */
+void arena_init(arena *a, void *mem, size_t size, size_t chunk) {
+    a->next = mem;
+    a->end = (char *)mem + size;
+    a->chunk = (chunk + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    a->free_list = NULL;
+}
+
+/* Returns a chunk or NULL if the pool is used up */
+void *arena_get(arena *a) {
+    void *c = a->free_list;
+
+    if (c != NULL) {
+        a->free_list = *(void **)c;
+        return c;
+    }
+    if ((size_t)(a->end - a->next) < a->chunk)
+        return NULL;
+    c = a->next;
+    a->next += a->chunk;
+    return c;
+}
+
+void arena_put(arena *a, void *chunk) {
+    *(void **)chunk = a->free_list;
+    a->free_list = chunk;
+}
@@ -0,0 +1,22 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Pool of fixed-size chunks carved out of one block of memory the caller
+ * provides, for data structures that mustn't call malloc while running.
+ * Freed chunks are kept on a free list and handed out again first.
+ */
+
+typedef struct {
+    char *next;
+    char *end;
+    size_t chunk;
+    void *free_list;
+} arena;
+
+void arena_init(arena *a, void *mem, size_t size, size_t chunk);
+void *arena_get(arena *a);
+void arena_put(arena *a, void *chunk);
+
+#endif
@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "banker.h"
+
+/* This module implements the safety check of the banker's algorithm.
+ * It works on the arrays in shared memory directly. Every loop over processes
+ * walks a resource's allocation and claim columns contiguously, without
+ * branches, so the compiler can vectorize it. In the sparse layout the
+ * allocation column is filled in from the holder list first.
+ *
+ * resource_requested() blocks a request whenever another process holds the
+ * resource, so a process can only finish when it needs nothing more from a
+ * resource or nobody else holds any of it and enough units are left.
+ */
+
+int banker_checks = 0;
+long banker_check_ns = 0;
+
+static int *held;
+static uchar *done;
+static uchar *can_finish;
+static int *column;
+
+void banker_init() {
+    free(held);
+    free(done);
+    free(can_finish);
+    free(column);
+    held = malloc(resource_num * sizeof(int));
+    done = malloc(pcb_num);
+    can_finish = malloc(pcb_num);
+    column = malloc(pcb_num * sizeof(int));
+}
+
+/* Returns units of res_id held by each process */
+static const int *allocation(int res_id) {
+    holding *h;
+
+    if (!shm->sparse)
+        return alloc_column(res_id);
+    memset(column, 0, pcb_num * sizeof(int));
+    h = holdings_of(res_id);
+    for (int i = 0; i < RES_MAX_LIMIT; i++)
+        column[h[i].pid] += h[i].units;
+    return column;
+}
+
+/* Marks processes in can_finish which could get everything they still need */
+static void find_finishable() {
+    for (int i = 0; i < pcb_num; i++)
+        can_finish[i] = !done[i];
+
+    for (int r = 0; r < resource_num; r++) {
+        const int *allocated = allocation(r);
+        const int *claim = claim_column(r);
+        int total = held[r];
+        int avail = res_info[r].limit - total;
+        for (int i = 0; i < pcb_num; i++) {
+            int need = claim[i] - allocated[i];
+            int others = total - allocated[i];
+            can_finish[i] &= (need <= 0) | ((need <= avail) & (others == 0));
+        }
+    }
+}
+
+/* Checks if everything pid needs can be given to it right away, which means
+ * it can finish first and the rest of a safe state stays safe */
+static bool can_finish_first(int pid) {
+    for (int r = 0; r < resource_num; r++) {
+        int allocated = units_held(r, pid);
+        int need = claim_column(r)[pid] - allocated;
+        if (need > 0 && (need > res_info[r].limit - held[r] || held[r] != allocated))
+            return false;
+    }
+    return true;
+}
+
+static bool state_safe(int pid) {
+    for (int r = 0; r < resource_num; r++)
+        held[r] = resources[r].total;
+
+    // The state before the request was safe, so it's enough if the requester can finish
+    if (can_finish_first(pid))
+        return true;
+
+    for (int i = 0; i < pcb_num; i++)
+        done[i] = pcb_state(i) == S_NOT_STARTED || !pcbs[i].claims_known;
+
+    // Let every process that can finish do so and return its resources, until nothing changes
+    for (;;) {
+        int progress = 0, remaining = 0;
+
+        find_finishable();
+        for (int i = 0; i < pcb_num; i++) {
+            progress |= can_finish[i];
+            done[i] |= can_finish[i];
+            remaining += !done[i];
+        }
+        if (remaining == 0)
+            return true;
+        if (!progress)
+            return false;
+
+        for (int r = 0; r < resource_num; r++) {
+            const int *allocated = allocation(r);
+            int freed = 0;
+            for (int i = 0; i < pcb_num; i++)
+                freed += can_finish[i] * allocated[i];
+            held[r] -= freed;
+        }
+    }
+}
+
+/* Checks if the system stays in a safe state after granting pid all of items at once */
+bool banker_safe_many(int pid, const res_amount *items, int n) {
+    struct timespec start, end;
+    bool safe = true;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // A process can't get more than it has declared
+    for (int i = 0; i < n; i++)
+        if (units_held(items[i].res_id, pid) + items[i].units > claim_column(items[i].res_id)[pid])
+            safe = false;
+    if (safe) {
+        // Pretend the units are granted
+        for (int i = 0; i < n; i++)
+            units_add(items[i].res_id, pid, items[i].units);
+        safe = state_safe(pid);
+        for (int i = 0; i < n; i++)
+            units_add(items[i].res_id, pid, -items[i].units);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    banker_checks++;
+    banker_check_ns += (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+
+    return safe;
+}
+
+/* Checks if pid could get everything it still needs right now. Granting such
+ * a process anything it waits for keeps a safe state safe, no check needed. */
+bool banker_can_finish(int pid) {
+    for (int r = 0; r < resource_num; r++)
+        held[r] = resources[r].total;
+    return can_finish_first(pid);
+}
+
+/* Checks if the system stays in a safe state after granting one unit of res_id to pid */
+bool banker_safe(int pid, int res_id) {
+    res_amount one = { res_id, 1 };
+    return banker_safe_many(pid, &one, 1);
+}
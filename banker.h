@@ -0,0 +1,21 @@
+#ifndef BANKER_H
+#define BANKER_H
+
+#include <stdbool.h>
+
+#include "common.h"
+
+/* Banker's algorithm for deadlock avoidance mode.
+ * Processes declare their maximum claims in claim_column() when they start.
+ */
+
+void banker_init();
+bool banker_safe(int pid, int res_id);
+bool banker_safe_many(int pid, const res_amount *items, int n);
+bool banker_can_finish(int pid);
+
+/* Safety checks run and total time spent in them */
+extern int banker_checks;
+extern long banker_check_ns;
+
+#endif
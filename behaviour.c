@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "behaviour.h"
+
+/* This module holds the decisions of a user process: when to request or release
+ * a resource and when to terminate. Each user has its own random seed, so a user
+ * behaves the same no matter which process it runs in.
+ */
+
+static int urand(user_state *u) {
+    return rand_r(&u->seed);
+}
+
+/* Declares maximum claims for avoidance mode, at least one unit of something */
+static void declare_claims(user_state *u)
+{
+    bool any = false;
+    for (int i = 0; i < resource_num; i++) {
+        int *claim = &claim_column(i)[u->pid];
+        *claim = urand(u) % (res_info[i].limit + 1);
+        if (*claim > 0)
+            any = true;
+    }
+    if (!any)
+        claim_column(urand(u) % resource_num)[u->pid] = 1;
+}
+
+/* Units of a resource we may still ask for */
+static int headroom(user_state *u, int id)
+{
+    if (shm->avoidance)
+        return claim_column(id)[u->pid] - u->allocated[id];
+    return res_info[id].limit - u->allocated[id];
+}
+
+static bool holds_any(user_state *u)
+{
+    for (int i = 0; i < resource_num; i++)
+        if (u->allocated[i] > 0)
+            return true;
+    return false;
+}
+
+/* Checks if we may ask for one more unit of a resource */
+static bool can_request(user_state *u, int id)
+{
+    return headroom(u, id) > 0;
+}
+
+static void terminate(user_state *u, ipc_message *msg)
+{
+    msg->type = chance_r(&u->seed, 20) ? RELEASE_ALL_AND_TERMINATE : IDLE;
+}
+
+static void request(user_state *u, ipc_message *msg)
+{
+    bool any = false;
+    for (int i = 0; i < resource_num; i++)
+        if (can_request(u, i))
+            any = true;
+    if (!any) {
+        msg->type = IDLE;
+        return;
+    }
+
+    msg->type = REQUEST;
+    do {
+        msg->res_id = urand(u) % resource_num;
+        // Don't request a resource if we're already holding all we can
+    } while (!can_request(u, msg->res_id));
+}
+
+static void release(user_state *u, ipc_message *msg)
+{
+    int allocated_types = 0;
+    int to_release;
+    int rid = 0;
+
+    for (int i = 0; i < resource_num; i++)
+        if (u->allocated[i] > 0)
+            allocated_types++;
+
+    if (allocated_types == 0) {
+        request(u, msg);
+        return;
+    }
+    to_release = urand(u) % allocated_types + 1;
+
+    for (int i = 0; i < resource_num; i++) {
+        if (u->allocated[i] > 0)
+            to_release--;
+        if (to_release == 0) {
+            rid = i;
+            break;
+        }
+    }
+
+    u->allocated[rid]--;
+    msg->type = RELEASE;
+    msg->res_id = rid;
+}
+
+static void release_many(user_state *u, ipc_message *msg);
+
+/* Asks for a few units of up to MSG_MAX_ITEMS resources in one message,
+ * the consecutive ones from a random one on that we may ask more of.
+ * Everything needed is asked for at once, so a user holding something
+ * mostly gives it back first instead of waiting for more while holding it. */
+static void request_many(user_state *u, ipc_message *msg)
+{
+    int want = urand(u) % MSG_MAX_ITEMS + 1;
+    int first = urand(u) % resource_num;
+
+    if (holds_any(u) && !chance_r(&u->seed, 20)) {
+        release_many(u, msg);
+        return;
+    }
+    msg->nitems = 0;
+    for (int i = 0; i < resource_num && msg->nitems < want; i++) {
+        int id = (first + i) % resource_num;
+        int room = headroom(u, id);
+        if (room <= 0)
+            continue;
+        msg->items[msg->nitems].res_id = id;
+        msg->items[msg->nitems].units = urand(u) % room + 1;
+        msg->nitems++;
+    }
+    msg->type = msg->nitems ? REQUEST_MANY : IDLE;
+}
+
+/* Gives back all units of up to MSG_MAX_ITEMS held resources in one message */
+static void release_many(user_state *u, ipc_message *msg)
+{
+    int want = urand(u) % MSG_MAX_ITEMS + 1;
+    int first = urand(u) % resource_num;
+
+    msg->nitems = 0;
+    for (int i = 0; i < resource_num && msg->nitems < want; i++) {
+        int id = (first + i) % resource_num;
+        if (u->allocated[id] == 0)
+            continue;
+        msg->items[msg->nitems].res_id = id;
+        msg->items[msg->nitems].units = u->allocated[id];
+        u->allocated[id] = 0;
+        msg->nitems++;
+    }
+    if (msg->nitems)
+        msg->type = RELEASE_MANY;
+    else
+        request_many(u, msg);
+}
+
+/* Sets up a user that has just been spawned */
+void behaviour_init(user_state *u, int pid, uint seed)
+{
+    memset(u, 0, sizeof(user_state));
+    u->pid = pid;
+    u->seed = seed;
+    u->allocated = calloc(resource_num, sizeof(int));
+
+    if (shm->avoidance)
+        declare_claims(u);
+
+    u->start_time = clock_now();
+    u->next_term = u->start_time;
+    osstime_advance(&u->next_term, 100000000);
+    u->next_res = u->start_time;
+    osstime_advance(&u->next_res, urand(u) % RES_INTERVAL);
+}
+
+static void step(user_state *u, ipc_message *reply)
+{
+    reply->_msgtyp = 0;
+    reply->type = IDLE;
+
+    // Check if terminating
+    if (u->next_term <= clock_now()) {
+        terminate(u, reply);
+        osstime_advance(&u->next_term, urand(u) % 250);
+        return;
+    }
+
+    // Check if requesting/releasing resource
+    if (u->next_res <= clock_now()) {
+        bool requesting = urand(u) % 2;
+        if (requesting && shm->batch_requests)
+            request_many(u, reply);
+        else if (requesting)
+            request(u, reply);
+        else if (shm->batch_requests)
+            release_many(u, reply);
+        else
+            release(u, reply);
+        osstime_advance(&u->next_res, urand(u) % RES_INTERVAL);
+    }
+}
+
+/* Decides what to do when oss says PROCESS, reply is what to tell oss */
+void behaviour_step(user_state *u, ipc_message *reply)
+{
+    step(u, reply);
+    // Nothing happens before the earlier of the two deadlines, oss needn't ask until then
+    reply->next = osstime_min(u->next_term, u->next_res);
+}
+
+/* oss has granted what msg says, a unit of a resource or a whole REQUEST_MANY */
+void behaviour_allocated(user_state *u, const ipc_message *msg)
+{
+    if (msg->type == ALLOCATE) {
+        u->allocated[msg->res_id]++;
+        return;
+    }
+    for (int i = 0; i < msg->nitems; i++)
+        u->allocated[msg->items[i].res_id] += msg->items[i].units;
+}
+
+/* Frees what behaviour_init() allocated */
+void behaviour_free(user_state *u)
+{
+    free(u->allocated);
+    u->allocated = NULL;
+}
@@ -0,0 +1,28 @@
+#ifndef BEHAVIOUR_H
+#define BEHAVIOUR_H
+
+#include <stdbool.h>
+
+#include "common.h"
+#include "messages.h"
+
+/* What a simulated user process does, kept apart from how it runs so the same
+ * logic drives both forked user processes and in-process users in oss.
+ */
+
+typedef struct {
+    int pid;
+    uint seed;
+    osstime start_time;
+    osstime next_term;
+    osstime next_res;
+    // Units held of each resource
+    int *allocated;
+} user_state;
+
+void behaviour_init(user_state *u, int pid, uint seed);
+void behaviour_step(user_state *u, ipc_message *reply);
+void behaviour_allocated(user_state *u, const ipc_message *msg);
+void behaviour_free(user_state *u);
+
+#endif
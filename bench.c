@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "common.h"
+#include "resmgr.h"
+
+/* Benchmarks the resource management core (resmgr.c) on synthetic workloads,
+ * without oss, users or IPC around it. The PCBs and resources are laid out
+ * in ordinary memory exactly like oss lays out its shared memory segment.
+ * Prints one CSV row per run to stdout, so runs of different commits can
+ * be compared line by line.
+ *
+ * uniform, hot and roomy drive random processes through spawn, request,
+ * release and terminate. cycle and chain build a wait-for chain of a given
+ * length and time one request at its end: in cycle it closes the chain into
+ * a deadlock which gets detected and recovered from, in chain it doesn't,
+ * but the search still has to walk the whole chain.
+ */
+
+typedef enum { W_UNIFORM, W_HOT, W_ROOMY, W_CYCLE, W_CHAIN, W_COUNT } workload;
+
+static const char *workload_names[W_COUNT] = { "uniform", "hot", "roomy", "cycle", "chain" };
+
+static const struct {
+    int pcbs;
+    int resources;
+} scales[] = {
+    { DEFAULT_PCB_NUM, DEFAULT_RESOURCE_NUM },
+    { 100, 50 },
+    { 1000, 200 },
+    { 10000, 1000 },
+};
+#define SCALES (int)(sizeof(scales) / sizeof(scales[0]))
+
+// The safety check looks at every PCB and resource, avoidance runs stop at this size
+#define AVOIDANCE_MAX_PAIRS 5000
+// and do this many times fewer operations
+#define AVOIDANCE_OPS_DIVISOR 10
+
+// Random runs count blocked processes every this many operations
+#define SAMPLE_OPS 1024
+
+// Requests timed for every chain length
+#define CHAIN_REPS 32
+
+static long ops = 200000;
+static int max_pcbs = 10000;
+static uint workload_mask = (1 << W_COUNT) - 1;
+static size_t layout_size;
+static int kills;
+
+/* Hooks of resmgr.c, there's nobody to log to or tell about grants */
+void logprintf(bool time, const char *fmt, ...) {
+}
+
+void forcelogprintf(const char *fmt, ...) {
+}
+
+void send_to_user(uint pid, ipc_message *msg) {
+}
+
+void kill_process(int pid) {
+    kills++;
+    resmgr_release_all(pid);
+}
+
+static long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static long maxrss_kb() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+/* Lays out PCBs and resources for a run and resets the core and its statistics */
+static void setup(int npcbs, int nresources, bool avoid, workload w) {
+    struct shm_data_t hdr;
+
+    free(shm);
+    pcb_num = npcbs;
+    resource_num = nresources;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.avoidance = avoid;
+    layout_size = layout_plan(&hdr);
+    if ((errno = posix_memalign((void **)&shm, CACHE_LINE, layout_size)) != 0) {
+        perror("posix_memalign");
+        exit(1);
+    }
+    memset(shm, 0, layout_size);
+    *shm = hdr;
+    layout_map();
+
+    for (int i = 0; i < resource_num; i++) {
+        switch (w) {
+        case W_ROOMY:
+            // Mostly resources with all the units there are, so fewer requests have to wait
+            res_info[i].shared = chance(20);
+            res_info[i].limit = chance(80) ? RES_MAX_LIMIT : rnd(1, RES_MAX_LIMIT);
+            break;
+        case W_CYCLE:
+        case W_CHAIN:
+            res_info[i].shared = false;
+            res_info[i].limit = 1;
+            break;
+        default:
+            // Same as oss
+            res_info[i].shared = chance(20);
+            res_info[i].limit = rnd(1, RES_MAX_LIMIT);
+            break;
+        }
+    }
+
+    avoidance = avoid;
+    resmgr_init();
+    requests_granted = 0;
+    dedeadlocks_run = 0;
+    dedeadlock_ns = 0;
+    safe_grants = 0;
+    unsafe_denials = 0;
+    kills = 0;
+}
+
+static void spawn(int pid) {
+    resmgr_start(pid);
+    if (!avoidance)
+        return;
+    // Claims like behaviour.c declares them
+    for (int i = 0; i < resource_num; i++)
+        claim_column(i)[pid] = rnd(0, res_info[i].limit);
+    pcbs[pid].claims_known = true;
+}
+
+/* Units pid may ask for in total */
+static int cap(int pid, int res_id) {
+    return avoidance ? claim_column(res_id)[pid] : res_info[res_id].limit;
+}
+
+static int pick_resource(workload w) {
+    // 90% of the requests go to 5% of the resources
+    if (w == W_HOT && chance(90))
+        return rnd(0, max(1, resource_num / 20) - 1);
+    return rnd(0, resource_num - 1);
+}
+
+/* Returns the first process from a random one on that isn't blocked or -1 if all are.
+ * Most processes are blocked under contention, so picking at random could take long.
+ */
+static int pick_pid() {
+    int start = rnd(0, pcb_num - 1);
+    for (int i = 0; i < pcb_num; i++) {
+        int pid = (start + i) % pcb_num;
+        if (pcb_state(pid) != S_BLOCKED)
+            return pid;
+    }
+    return -1;
+}
+
+/* Returns a random resource pid holds or -1 */
+static int pick_held(int pid) {
+    int cursor = 0, res_id, picked = -1, seen = 0;
+    while ((res_id = held_next(pid, &cursor)) != -1)
+        if (rnd(0, seen++) == 0)
+            picked = res_id;
+    return picked;
+}
+
+/* One thing a process would do, returns false if every process is blocked */
+static bool random_op(workload w) {
+    int pid = pick_pid();
+    int res_id;
+
+    if (pid == -1)
+        return false;
+    if (pcb_state(pid) == S_NOT_STARTED) {
+        spawn(pid);
+        return true;
+    }
+    if (chance(2)) {
+        resmgr_release_all(pid);
+        return true;
+    }
+    if (chance(55)) {
+        res_id = pick_resource(w);
+        if (units_held(res_id, pid) < cap(pid, res_id)) {
+            resource_requested(pid, res_id);
+            return true;
+        }
+    }
+    if ((res_id = pick_held(pid)) != -1)
+        resource_released(pid, res_id);
+    return true;
+}
+
+static void print_row(workload w, const char *layout, double graph, long count, double ns_per_op,
+        double detect_ns) {
+    printf("%s,%s,%d,%d,%s,%.1f,%ld,%.1f,%d,%.1f,%d,%d,%zu,%ld\n", workload_names[w],
+            avoidance ? "avoid" : "detect", pcb_num, resource_num, layout, graph, count, ns_per_op,
+            dedeadlocks_run, detect_ns, requests_granted, kills, layout_size, maxrss_kb());
+    fflush(stdout);
+}
+
+static void run_random(workload w, int npcbs, int nresources, bool avoid) {
+    long done = 0, ns = 0, blocked = 0, samples = 0;
+    long total = avoid ? max(1, ops / AVOIDANCE_OPS_DIVISOR) : ops;
+
+    srand(1);
+    setup(npcbs, nresources, avoid, w);
+    while (done < total) {
+        long start = now_ns(), n;
+        for (n = 0; n < SAMPLE_OPS && done + n < total; n++)
+            if (!random_op(w))
+                break;
+        ns += now_ns() - start;
+        done += n;
+        for (int pid = 0; pid < pcb_num; pid++)
+            blocked += pcb_state(pid) == S_BLOCKED;
+        samples++;
+        if (n < SAMPLE_OPS && done < total)
+            break;
+    }
+    print_row(w, shm->sparse ? "sparse" : "dense", (double)blocked / samples, done, (double)ns / done,
+            dedeadlocks_run ? (double)dedeadlock_ns / dedeadlocks_run : 0);
+}
+
+/* P0 .. Plen-1 each get R i and then wait for R i+1, Plen-1 is left running.
+ * Each block is found not to close a cycle after one step.
+ */
+static void build_chain(int len) {
+    for (int i = 0; i < len; i++) {
+        spawn(i);
+        resource_requested(i, i);
+    }
+    for (int i = 0; i < len - 1; i++)
+        resource_requested(i, i + 1);
+}
+
+static void run_chain(workload w, int npcbs, int nresources, int len) {
+    long ns = 0, detect = 0;
+    // The extra process waiting at the start of an open chain
+    int last = w == W_CYCLE ? len - 1 : len;
+
+    srand(1);
+    setup(npcbs, nresources, false, w);
+    for (int rep = 0; rep < CHAIN_REPS; rep++) {
+        build_chain(len);
+        if (w == W_CHAIN)
+            spawn(last);
+
+        long detect_before = dedeadlock_ns;
+        long start = now_ns();
+        resource_requested(last, 0);
+        ns += now_ns() - start;
+        detect += dedeadlock_ns - detect_before;
+
+        for (int pid = 0; pid <= last; pid++)
+            if (pcb_state(pid) != S_NOT_STARTED)
+                resmgr_release_all(pid);
+    }
+    print_row(w, shm->sparse ? "sparse" : "dense", len, CHAIN_REPS, (double)ns / CHAIN_REPS,
+            (double)detect / CHAIN_REPS);
+}
+
+static void run_chains(workload w, int npcbs, int nresources) {
+    // An open chain needs one more process than it has links
+    int longest = min(nresources, w == W_CYCLE ? npcbs : npcbs - 1);
+
+    for (int len = 2; len <= longest; len *= 2)
+        run_chain(w, npcbs, nresources, len);
+    if (longest >= 2 && (longest & (longest - 1)) != 0)
+        run_chain(w, npcbs, nresources, longest);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n ops] [-p max_pcbs] [-w workload[,workload...]]\n", prog);
+    fprintf(stderr, "  -n  operations in every random run (default %ld)\n", ops);
+    fprintf(stderr, "  -p  skip scales with more PCBs than this (default %d)\n", max_pcbs);
+    fprintf(stderr, "  -w  only these workloads:");
+    for (int i = 0; i < W_COUNT; i++)
+        fprintf(stderr, " %s", workload_names[i]);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+static uint parse_workloads(char *list, const char *prog) {
+    uint mask = 0;
+
+    for (char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+        int i;
+        for (i = 0; i < W_COUNT; i++)
+            if (!strcmp(name, workload_names[i]))
+                break;
+        if (i == W_COUNT)
+            usage(prog);
+        mask |= 1 << i;
+    }
+    return mask;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:p:w:")) != -1) {
+        switch (opt) {
+        case 'n':
+            ops = atol(optarg);
+            if (ops < 1)
+                usage(argv[0]);
+            break;
+        case 'p':
+            max_pcbs = atoi(optarg);
+            break;
+        case 'w':
+            workload_mask = parse_workloads(optarg, argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    printf("workload,mode,pcbs,resources,layout,graph,ops,ns_per_op,detections,detect_ns,grants,kills,"
+            "mem_bytes,maxrss_kb\n");
+    for (int s = 0; s < SCALES && scales[s].pcbs <= max_pcbs; s++) {
+        int p = scales[s].pcbs, r = scales[s].resources;
+        for (workload w = W_UNIFORM; w <= W_ROOMY; w++) {
+            if (!(workload_mask & (1 << w)))
+                continue;
+            run_random(w, p, r, false);
+            if ((long)p * r <= AVOIDANCE_MAX_PAIRS)
+                run_random(w, p, r, true);
+        }
+        for (workload w = W_CYCLE; w <= W_CHAIN; w++)
+            if (workload_mask & (1 << w))
+                run_chains(w, p, r);
+    }
+    return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef BITSET_H
+#define BITSET_H
+
+#include <stdbool.h>
+
+#include "types.h"
+
+/* Fixed-size bit sets stored as arrays of ulong words.
+ * Used for sets of PCB indices (holders of a resource, visited marks etc.)
+ */
+
+#define BITS_PER_WORD (8 * sizeof(ulong))
+#define BITSET_WORDS(n) (((n) + BITS_PER_WORD - 1) / BITS_PER_WORD)
+
+static inline void bitset_set(ulong *set, int i) {
+    set[i / BITS_PER_WORD] |= 1UL << (i % BITS_PER_WORD);
+}
+
+static inline void bitset_clear(ulong *set, int i) {
+    set[i / BITS_PER_WORD] &= ~(1UL << (i % BITS_PER_WORD));
+}
+
+static inline bool bitset_test(const ulong *set, int i) {
+    return (set[i / BITS_PER_WORD] >> (i % BITS_PER_WORD)) & 1;
+}
+
+/* Returns the first set bit at index >= from, or -1 if there's none below nbits */
+static inline int bitset_next(const ulong *set, int nbits, int from) {
+    if (from >= nbits)
+        return -1;
+    uint w = from / BITS_PER_WORD;
+    ulong word = set[w] & (~0UL << (from % BITS_PER_WORD));
+    while (word == 0) {
+        if (++w >= BITSET_WORDS(nbits))
+            return -1;
+        word = set[w];
+    }
+    int i = w * BITS_PER_WORD + __builtin_ctzl(word);
+    return i < nbits ? i : -1;
+}
+
+#define bitset_foreach(i, set, nbits) \
+    for (int i = bitset_next(set, nbits, 0); i != -1; i = bitset_next(set, nbits, i + 1))
+
+#endif
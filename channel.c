@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "channel.h"
+
+/* This module carries ipc_messages between oss and user processes.
+ *
+ * T_MSGQ uses a pair of System V message queues per PCB, which costs two
+ * system calls and two copies through the kernel per message.
+ *
+ * T_SHM uses a pair of single-producer single-consumer rings per PCB in shared
+ * memory. Sending a message is a copy and a release store of tail. A consumer
+ * that finds its ring empty parks on a futex on the tail word and the producer
+ * only makes the wake system call if the consumer said it's parked.
+ */
+
+#define PERMS 0666
+
+// Parked receivers wake up this often to check if they were interrupted
+#define PARK_TIMEOUT_NS 10000000
+
+static volatile sig_atomic_t interrupted = 0;
+
+static int futex(uint *addr, int op, uint val, const struct timespec *timeout) {
+    return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static msgring *ring_of(int pid, direction dir) {
+    channel *ch = &channels[pid];
+    return dir == TO_USER ? &ch->to_user : &ch->to_oss;
+}
+
+static int msq_of(int pid, direction dir) {
+    return dir == TO_USER ? pcbs[pid].msq_to_user : pcbs[pid].msq_to_oss;
+}
+
+static void ring_send(msgring *ring, ipc_message *msg) {
+    // Full rings don't happen with the request/reply protocol, but don't overwrite anything
+    while (!msgring_push(ring, msg))
+        sched_yield();
+
+    // Pairs with the fence in ring_recv, either we see it parked or it sees the new tail
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_RELAXED))
+        futex(&ring->tail, FUTEX_WAKE, 1, NULL);
+}
+
+static int ring_recv(msgring *ring, ipc_message *msg) {
+    uint head = ring->head;
+    struct timespec timeout = { 0, PARK_TIMEOUT_NS };
+
+    while (!msgring_pop(ring, msg)) {
+        if (interrupted) {
+            errno = EINTR;
+            return -1;
+        }
+        __atomic_store_n(&ring->waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->tail, __ATOMIC_RELAXED) == head)
+            futex(&ring->tail, FUTEX_WAIT, head, &timeout);
+        __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+/* Marks every PCB's message queues as not there, oss does it once at start */
+void channel_init() {
+    for (int i = 0; i < pcb_num; i++)
+        pcbs[i].msq_to_user = pcbs[i].msq_to_oss = -1;
+}
+
+/* Creates the channel of a PCB, oss does it before forking the user process
+ * so the user can't look at it before it exists */
+void channel_open(int pid) {
+    pcb *pcb = &pcbs[pid];
+
+    if (shm->transport == T_SHM) {
+        memset(&channels[pid], 0, sizeof(channel));
+        return;
+    }
+
+    pcb->msq_to_user = msgget(IPC_PRIVATE, IPC_CREAT | PERMS);
+    pcb->msq_to_oss = msgget(IPC_PRIVATE, IPC_CREAT | PERMS);
+    EXIT_ON_ERROR(pcb->msq_to_user, "msgget");
+    EXIT_ON_ERROR(pcb->msq_to_oss, "msgget");
+}
+
+static void msqrm(int *msqid) {
+    if (-1 == msgctl(*msqid, IPC_RMID, NULL))
+        perror("msgrm");
+    *msqid = -1;
+}
+
+void channel_close(int pid) {
+    pcb *pcb = &pcbs[pid];
+
+    if (shm->transport == T_SHM)
+        return;
+
+    msqrm(&pcb->msq_to_oss);
+    msqrm(&pcb->msq_to_user);
+}
+
+/* Removes the message queues oss left open, for cleaning up after it has
+ * died. Doesn't use stdio, it runs in a process forked from a threaded one. */
+void channel_reap() {
+    if (shm->transport == T_SHM)
+        return;
+    for (int i = 0; i < pcb_num; i++) {
+        if (pcbs[i].msq_to_oss != -1)
+            msgctl(pcbs[i].msq_to_oss, IPC_RMID, NULL);
+        if (pcbs[i].msq_to_user != -1)
+            msgctl(pcbs[i].msq_to_user, IPC_RMID, NULL);
+    }
+}
+
+void channel_send(int pid, direction dir, ipc_message *msg) {
+    if (shm->transport == T_SHM) {
+        ring_send(ring_of(pid, dir), msg);
+        return;
+    }
+    msgsnd(msq_of(pid, dir), msg, msg_size, 0);
+}
+
+/* Waits for a message. Returns -1 with errno set if it fails, EINTR if the
+ * receiver was interrupted by channel_interrupt() or a signal */
+int channel_recv(int pid, direction dir, ipc_message *msg) {
+    if (shm->transport == T_SHM)
+        return ring_recv(ring_of(pid, dir), msg);
+    return msgrcv(msq_of(pid, dir), msg, msg_size, 0, 0);
+}
+
+/* Makes receivers give up, safe to call from a signal handler */
+void channel_interrupt() {
+    interrupted = 1;
+}
@@ -0,0 +1,21 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include "common.h"
+#include "messages.h"
+
+/* Message passing between oss and a user process, over System V message queues
+ * or over rings in shared memory, depending on shm->transport.
+ */
+
+typedef enum { TO_USER, TO_OSS } direction;
+
+void channel_init();
+void channel_open(int pid);
+void channel_close(int pid);
+void channel_send(int pid, direction dir, ipc_message *msg);
+int channel_recv(int pid, direction dir, ipc_message *msg);
+void channel_interrupt();
+void channel_reap();
+
+#endif
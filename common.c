@@ -1,39 +1,308 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <unistd.h>
 #include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "common.h"
 
+/* The segment is an anonymous memfd. oss creates it and passes it on to
+ * its children as an inherited file descriptor named in SHM_FD_ENV, so no
+ * key is shared with anything else on the host and the memory goes away
+ * with the last process that has it open or mapped, even after a crash.
+ */
+
+// Size huge page backed segments are rounded up to
+#define HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+int shm_fd = -1;
+size_t shm_size;
+struct shm_data_t *shm;
+
+int pcb_num = DEFAULT_PCB_NUM;
+int resource_num = DEFAULT_RESOURCE_NUM;
+pcb *pcbs;
+resource_info *res_info;
+resource *resources;
+channel *channels;
+int *shm_alloc_by_res;
+int *shm_alloc_by_pid;
+ulong *shm_holders;
+holding *shm_holdings;
+int *shm_claims;
+stats_page *shm_stats;
+res_stats *shm_res_stats;
+pcb_stats *shm_pcb_stats;
+
+/* Unmaps and closes the segment, it's freed once the children have too */
 void deallocate() {
-	struct shmid_ds shmid_ds;
-	int result;
+    detach();
+    close(shm_fd);
+    shm_fd = -1;
+}
+
+static int create(size_t size, unsigned int flags) {
+    int fd = memfd_create("oss", flags);
 
-	result = shmctl(shmid, IPC_RMID, &shmid_ds);
-	EXIT_ON_ERROR(result, "shmctl")
+    if (fd == -1)
+        return -1;
+    if (ftruncate(fd, size) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
 }
 
-void allocate() {
-	shmid = shmget (KEY, sizeof(struct shm_data_t), IPC_CREAT | 0666);
+/* Creates a segment of at least size bytes, or opens the one oss passed
+ * down if size is 0. With huge, it's backed by huge pages if the system has
+ * enough of them reserved and asks for transparent huge pages otherwise.
+ * Returns true if it got reserved huge pages.
+ */
+bool allocate(size_t size, bool huge) {
+    struct stat st;
+    char *env;
 
-	EXIT_ON_ERROR(shmid, "shmget")
+    if (size == 0) {
+        if ((env = getenv(SHM_FD_ENV)) == NULL) {
+            fprintf(stderr, "%s isn't set, users are started by oss\n", SHM_FD_ENV);
+            exit(1);
+        }
+        shm_fd = atoi(env);
+        EXIT_ON_ERROR(fstat(shm_fd, &st), "fstat")
+        shm_size = st.st_size;
+        return false;
+    }
+
+    if (huge) {
+        shm_size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        // Reserved huge pages are taken when mapping, without enough of them that fails
+        if ((shm_fd = create(shm_size, MFD_HUGETLB)) != -1) {
+            void *probe = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+            if (probe != MAP_FAILED) {
+                munmap(probe, shm_size);
+                return true;
+            }
+            close(shm_fd);
+        }
+    } else {
+        shm_size = size;
+    }
+
+    shm_fd = create(shm_size, 0);
+    EXIT_ON_ERROR(shm_fd, "memfd_create")
+    return false;
 }
 
+/* Maps the segment, see allocate() */
 void attach() {
-	shm = shmat(shmid, NULL, 0);
-    if (shm == (void*)-1) {
-        perror("shmat");
+    shm = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (shm == MAP_FAILED) {
+        perror("mmap");
         exit(1);
     }
+    // Transparent huge pages for shared memory, if the system allows them on request
+    if (shm_size % HUGE_PAGE_SIZE == 0)
+        madvise(shm, shm_size, MADV_HUGEPAGE);
 }
 
 void detach() {
-	int result;
+    EXIT_ON_ERROR(munmap(shm, shm_size), "munmap")
+}
+
+/* Faults in every page of the mapping now instead of at first touch */
+void prefault() {
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(shm, shm_size, MADV_POPULATE_WRITE) == 0)
+        return;
+#endif
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t off = 0; off < shm_size; off += page)
+        (void)*(volatile char *)((char *)shm + off);
+}
+
+/* Adds an array of given size to the end of the segment, returns its offset */
+static size_t add_region(size_t *size, size_t bytes) {
+    size_t offset = *size;
+
+    if (bytes == 0)
+        return 0;
+    // Keep every array on its own cache lines
+    *size += (bytes + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    return offset;
+}
+
+/* Rounds a number of ints up to whole cache lines */
+static int ints_stride(int n) {
+    int per_line = CACHE_LINE / sizeof(int);
+    return (n + per_line - 1) / per_line * per_line;
+}
+
+/* Fills in the dimensions and offsets of hdr for pcb_num, resource_num, avoidance and
+ * transport, returns the size of the segment */
+size_t layout_plan(struct shm_data_t *hdr) {
+    size_t size = 0;
+
+    add_region(&size, sizeof(struct shm_data_t));
+    hdr->pcb_num = pcb_num;
+    hdr->resource_num = resource_num;
+    hdr->sparse = (size_t)pcb_num * resource_num > SPARSE_THRESHOLD;
+    hdr->pcb_stride = ints_stride(pcb_num);
+    hdr->res_stride = ints_stride(resource_num);
+    hdr->pcbs_off = add_region(&size, pcb_num * sizeof(pcb));
+    hdr->res_info_off = add_region(&size, resource_num * sizeof(resource_info));
+    hdr->resources_off = add_region(&size, resource_num * sizeof(resource));
+    if (hdr->sparse) {
+        hdr->holdings_off = add_region(&size, resource_num * RES_MAX_LIMIT * sizeof(holding));
+    } else {
+        hdr->alloc_by_res_off = add_region(&size, (size_t)resource_num * hdr->pcb_stride * sizeof(int));
+        hdr->alloc_by_pid_off = add_region(&size, (size_t)pcb_num * hdr->res_stride * sizeof(int));
+        hdr->holders_off = add_region(&size, resource_num * BITSET_WORDS(pcb_num) * sizeof(ulong));
+    }
+    if (hdr->avoidance)
+        hdr->claims_off = add_region(&size, (size_t)resource_num * hdr->pcb_stride * sizeof(int));
+    if (hdr->transport == T_SHM)
+        hdr->channels_off = add_region(&size, pcb_num * sizeof(channel));
+    hdr->stats_off = add_region(&size, sizeof(stats_page));
+    hdr->res_stats_off = add_region(&size, resource_num * sizeof(res_stats));
+    hdr->pcb_stats_off = add_region(&size, pcb_num * sizeof(pcb_stats));
+    hdr->size = size;
+    return size;
+}
+
+static void *region(size_t offset) {
+    return offset ? (char *)shm + offset : NULL;
+}
+
+/* Points the globals to the arrays of the attached segment */
+void layout_map() {
+    pcb_num = shm->pcb_num;
+    resource_num = shm->resource_num;
+    pcbs = region(shm->pcbs_off);
+    res_info = region(shm->res_info_off);
+    resources = region(shm->resources_off);
+    shm_alloc_by_res = region(shm->alloc_by_res_off);
+    shm_alloc_by_pid = region(shm->alloc_by_pid_off);
+    shm_holders = region(shm->holders_off);
+    shm_holdings = region(shm->holdings_off);
+    shm_claims = region(shm->claims_off);
+    channels = region(shm->channels_off);
+    shm_stats = region(shm->stats_off);
+    shm_res_stats = region(shm->res_stats_off);
+    shm_pcb_stats = region(shm->pcb_stats_off);
+}
+
+/* Changes units of res_id held by pid by units in both the dense matrices */
+static void dense_add(int res_id, int pid, int units) {
+    resource *r = &resources[res_id];
+    int *by_pid = &alloc_row(pid)[res_id];
+    ulong *holders = shm_holders + (size_t)res_id * BITSET_WORDS(pcb_num);
+    int before = *by_pid;
+
+    *by_pid += units;
+    alloc_column(res_id)[pid] = *by_pid;
+    if (before == 0 && *by_pid > 0) {
+        bitset_set(holders, pid);
+        r->nholders++;
+    } else if (before > 0 && *by_pid == 0) {
+        bitset_clear(holders, pid);
+        r->nholders--;
+    }
+}
+
+/* Same in the holder list of res_id and the chain of pid */
+static void sparse_add(int res_id, int pid, int units) {
+    resource *r = &resources[res_id];
+    holding *h = holdings_of(res_id);
+    int slot = -1, free_slot = -1;
+
+    for (int i = 0; i < RES_MAX_LIMIT; i++) {
+        if (h[i].units > 0 && h[i].pid == pid)
+            slot = i;
+        else if (h[i].units == 0 && free_slot == -1)
+            free_slot = i;
+    }
+
+    if (slot == -1) {
+        // Nobody holds more than limit units in total, so there's always room
+        int index = res_id * RES_MAX_LIMIT + free_slot;
+        slot = free_slot;
+        h[slot].pid = pid;
+        h[slot].units = 0;
+        h[slot].pid_prev = -1;
+        h[slot].pid_next = pcbs[pid].held_head;
+        if (pcbs[pid].held_head != -1)
+            shm_holdings[pcbs[pid].held_head].pid_prev = index;
+        pcbs[pid].held_head = index;
+        r->nholders++;
+    }
+
+    h[slot].units += units;
+    if (h[slot].units == 0) {
+        int prev = h[slot].pid_prev, next = h[slot].pid_next;
+        if (prev == -1)
+            pcbs[pid].held_head = next;
+        else
+            shm_holdings[prev].pid_next = next;
+        if (next != -1)
+            shm_holdings[next].pid_prev = prev;
+        r->nholders--;
+    }
+}
 
-	result = shmdt(shm);
-	EXIT_ON_ERROR(result, "shmdt")
+/* Changes units of res_id held by pid by units, keeping total and the holder data in sync */
+void units_add(int res_id, int pid, int units) {
+    resources[res_id].total += units;
+    if (shm->sparse)
+        sparse_add(res_id, pid, units);
+    else
+        dense_add(res_id, pid, units);
+}
+
+/* Returns the next PCB holding res_id or -1. cursor starts at 0 and is advanced past
+ * the returned holder, the holders mustn't change while iterating. */
+int holder_next(int res_id, int *cursor) {
+    if (!shm->sparse) {
+        ulong *holders = shm_holders + (size_t)res_id * BITSET_WORDS(pcb_num);
+        int pid = bitset_next(holders, pcb_num, *cursor);
+        *cursor = pid == -1 ? pcb_num : pid + 1;
+        return pid;
+    }
+
+    holding *h = holdings_of(res_id);
+    while (*cursor < RES_MAX_LIMIT) {
+        int i = (*cursor)++;
+        if (h[i].units > 0)
+            return h[i].pid;
+    }
+    return -1;
+}
+
+/* Returns the next resource pid holds units of or -1. cursor starts at 0 and is
+ * advanced past the returned resource, which may be released before the next call. */
+int held_next(int pid, int *cursor) {
+    if (!shm->sparse) {
+        const int *row = alloc_row(pid);
+        for (int r = *cursor; r < resource_num; r++)
+            if (row[r] > 0) {
+                *cursor = r + 1;
+                return r;
+            }
+        *cursor = resource_num;
+        return -1;
+    }
+
+    // cursor is 1 + next slot of the chain, or -1 at its end
+    int index = *cursor == 0 ? pcbs[pid].held_head : *cursor - 1;
+    if (*cursor == -1 || index == -1) {
+        *cursor = -1;
+        return -1;
+    }
+    *cursor = shm_holdings[index].pid_next == -1 ? -1 : shm_holdings[index].pid_next + 1;
+    return index / RES_MAX_LIMIT;
 }
 
 int rnd(int min, int max)
@@ -45,3 +314,9 @@ bool chance(int percent)
 {
     return (rand() % 100) < percent;
 }
+
+/* Same as chance() with a caller's own random state */
+bool chance_r(uint *seed, int percent)
+{
+    return (rand_r(seed) % 100) < percent;
+}
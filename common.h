@@ -2,11 +2,18 @@
 #define COMMON_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "types.h"
 #include "osstime.h"
+#include "bitset.h"
+#include "messages.h"
+#include "log.h"
+#include "stats.h"
+#include "ring.h"
 
-#define KEY 19283746
+// Environment variable telling oss's children the descriptor of the segment
+#define SHM_FD_ENV "OSS_SHM_FD"
 
 #define EXIT_ON_ERROR(VAR, STR) if (VAR == -1) { \
 		perror(STR); \
@@ -23,43 +30,244 @@
       __typeof__ (b) _b = (b); \
     _a < _b ? _a : _b; })
 
-#define KEY_PREFIX 123456
-
-#define PCB_NUM 18
-#define RESOURCE_NUM 20
+#define DEFAULT_PCB_NUM 18
+#define DEFAULT_RESOURCE_NUM 20
 #define RES_INTERVAL 10000
+// Resources have 1 to RES_MAX_LIMIT units
+#define RES_MAX_LIMIT 10
+// Above this many PCB/resource pairs holders are kept in lists instead of a matrix
+#define SPARSE_THRESHOLD (64 * 1024)
 
 typedef enum { S_NOT_STARTED, S_ACTIVE, S_BLOCKED } process_state;
 
+// How oss and user processes exchange messages
+typedef enum { T_MSGQ, T_SHM } transport_type;
+
+#define MSGRING_SIZE 8
+
+/* Every PCB has a cache line of its own. oss writes it and only the PCB's own
+ * user process reads it, so users don't slow each other down. */
 typedef struct {
 	int pid;
+    // Only through pcb_state() and pcb_set_state()
     process_state state;
 	int msq_to_user;
 	int msq_to_oss;
+    // Resource waited on while S_BLOCKED
     int blocked_on;
-} pcb;
+    // Avoidance mode: oss has seen the process's maximum claims
+    bool claims_known;
+    // Neighbours and key in the wait queue of blocked_on
+    int wq_prev;
+    int wq_next;
+    int wq_key;
+    // First entry of the PCB's chain of holdings in the sparse layout
+    int held_head;
+} __attribute__((aligned(CACHE_LINE))) pcb;
 
+/* Queue of processes blocked on a resource, linked through their PCBs.
+ * Entries are kept ordered by key, highest first, FIFO among equal keys.
+ */
+typedef struct {
+    int head;
+    int tail;
+    int count;
+} waitq;
+
+/* Configuration of a resource, never changes after oss has set it up.
+ * Users read it, so it's kept apart from the state oss keeps changing. */
 typedef struct {
     bool shared;
     int limit;
-    int allocated[PCB_NUM];
+} resource_info;
+
+/* State of a resource, only oss uses it.
+ * total and nholders are caches of the units held by each PCB,
+ * oss only changes them together with the data they describe */
+typedef struct {
+    // Sum of units held
+    int total;
+    // PCBs holding at least one unit
+    int nholders;
+    // PCBs blocked waiting on this resource in the order they'll be woken up
+    waitq queue;
 } resource;
 
+/* Slot of a resource's holder list in the sparse layout, free if units is 0.
+ * Used slots are also chained per PCB, so a PCB's holdings can be found
+ * without looking at every resource. */
+typedef struct {
+    int pid;
+    int units;
+    int pid_prev;
+    int pid_next;
+} holding;
+
+/* Single-producer single-consumer ring of messages, see ring.h */
+SHMRING(msgring, ipc_message, MSGRING_SIZE)
+
+typedef struct {
+    msgring to_user;
+    msgring to_oss;
+} channel;
+
+/* Header of the shared segment. The arrays follow it at the given offsets from
+ * the start of the segment, an offset is 0 if the array isn't used in this run.
+ * Every process maps them to the globals below after attaching.
+ * The header never changes after oss has set it up, except cpu_clock which is
+ * on a cache line of its own.
+ */
 struct shm_data_t {
-	osstime cpu_clock;
-	pcb pcbs[PCB_NUM];
-    resource resources[RESOURCE_NUM];
+    // Run with the banker's algorithm instead of deadlock detection
+    bool avoidance;
+    transport_type transport;
+    // Users only log if it's L_DEBUG
+    log_level log_min_level;
+    // Users ask for and give back several resources in one message
+    bool batch_requests;
+    // Every process faults in the whole segment when it maps it
+    bool prefault;
+    int pcb_num;
+    int resource_num;
+    // Holders are kept in per-resource lists instead of matrices
+    bool sparse;
+    // Row lengths of the matrices below, padded to whole cache lines
+    int pcb_stride;
+    int res_stride;
+    size_t size;
+    // pcb[pcb_num]
+    size_t pcbs_off;
+    // resource_info[resource_num]
+    size_t res_info_off;
+    // resource[resource_num]
+    size_t resources_off;
+    // Dense layout: units held by resource, int[resource_num][pcb_stride]
+    size_t alloc_by_res_off;
+    // Dense layout: same units by PCB, int[pcb_num][res_stride]
+    size_t alloc_by_pid_off;
+    // Dense layout: bit set of holders, ulong[resource_num][BITSET_WORDS(pcb_num)]
+    size_t holders_off;
+    // Sparse layout: holder lists, holding[resource_num][RES_MAX_LIMIT]
+    size_t holdings_off;
+    // Maximum claims declared in avoidance mode, int[resource_num][pcb_stride]
+    size_t claims_off;
+    // Message rings used by T_SHM transport, channel[pcb_num]
+    size_t channels_off;
+    // Statistics, stats_page, res_stats[resource_num] and pcb_stats[pcb_num]
+    size_t stats_off;
+    size_t res_stats_off;
+    size_t pcb_stats_off;
+
+    // Written by oss all the time and read by every user
+	osstime cpu_clock __attribute__((aligned(CACHE_LINE)));
 };
 
-int shmid;
-struct shm_data_t *shm;
+extern int shm_fd;
+extern size_t shm_size;
+extern struct shm_data_t *shm;
 
-void allocate();
+/* Dimensions and arrays of the attached segment */
+extern int pcb_num;
+extern int resource_num;
+extern pcb *pcbs;
+extern resource_info *res_info;
+extern resource *resources;
+extern channel *channels;
+extern int *shm_alloc_by_res;
+extern int *shm_alloc_by_pid;
+extern ulong *shm_holders;
+extern holding *shm_holdings;
+extern int *shm_claims;
+extern stats_page *shm_stats;
+extern res_stats *shm_res_stats;
+extern pcb_stats *shm_pcb_stats;
+
+bool allocate(size_t size, bool huge);
 void deallocate();
 void attach();
 void detach();
+void prefault();
+size_t layout_plan(struct shm_data_t *hdr);
+void layout_map();
+
+/* What the processes sharing the segment may see of each other's writes:
+ *
+ * - The header, res_info and the message queue ids in the PCBs are written by
+ *   oss before it forks the users that read them, fork orders those writes
+ *   before anything the users do.
+ * - The clock and PCB states have oss as their only writer and may be read at
+ *   any time. Each is one aligned word accessed with __atomic builtins, so a
+ *   read never tears. Stores are releases and loads acquires: whoever reads
+ *   a clock value or a state also sees everything oss wrote before storing
+ *   it, e.g. blocked_on of a process seen as S_BLOCKED. On x86 both are
+ *   plain moves. With manager threads (-m) several oss threads advance the
+ *   clock at once, so advancing is an atomic add.
+ * - Maximum claims are written by a user before its first reply to PROCESS
+ *   and the message (a system call, or the release/acquire pair on a ring
+ *   index) orders them before oss reads the reply. Until then the claims
+ *   don't count, claims_known stays false and the banker ignores the
+ *   process, which can't hold anything before its first request.
+ * - Everything else is only used by oss.
+ *
+ * So correctness doesn't depend on oss and users taking turns, the message
+ * round trip is only needed to hand over requests and grants.
+ */
+static inline osstime clock_now() {
+    return __atomic_load_n(&shm->cpu_clock, __ATOMIC_ACQUIRE);
+}
+
+static inline void clock_set(osstime t) {
+    __atomic_store_n(&shm->cpu_clock, t, __ATOMIC_RELEASE);
+}
+
+static inline void clock_advance(ulong ticks) {
+    __atomic_fetch_add(&shm->cpu_clock, ticks, __ATOMIC_RELEASE);
+}
+
+static inline process_state pcb_state(int pid) {
+    return __atomic_load_n(&pcbs[pid].state, __ATOMIC_ACQUIRE);
+}
+
+static inline void pcb_set_state(int pid, process_state state) {
+    __atomic_store_n(&pcbs[pid].state, state, __ATOMIC_RELEASE);
+}
+
+/* Units of res_id held by each PCB, only in the dense layout */
+static inline int *alloc_column(int res_id) {
+    return shm_alloc_by_res + (size_t)res_id * shm->pcb_stride;
+}
+
+/* Units of each resource held by pid, only in the dense layout */
+static inline int *alloc_row(int pid) {
+    return shm_alloc_by_pid + (size_t)pid * shm->res_stride;
+}
+
+/* Maximum claims on res_id of each PCB, only in avoidance mode */
+static inline int *claim_column(int res_id) {
+    return shm_claims + (size_t)res_id * shm->pcb_stride;
+}
+
+static inline holding *holdings_of(int res_id) {
+    return shm_holdings + (size_t)res_id * RES_MAX_LIMIT;
+}
+
+/* Units of res_id held by pid */
+static inline int units_held(int res_id, int pid) {
+    if (!shm->sparse)
+        return alloc_row(pid)[res_id];
+    holding *h = holdings_of(res_id);
+    for (int i = 0; i < RES_MAX_LIMIT; i++)
+        if (h[i].units > 0 && h[i].pid == pid)
+            return h[i].units;
+    return 0;
+}
+
+void units_add(int res_id, int pid, int units);
+int holder_next(int res_id, int *cursor);
+int held_next(int pid, int *cursor);
 
 int rnd(int min, int max);
 bool chance(int percent);
+bool chance_r(uint *seed, int percent);
 
 #endif
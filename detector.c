@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "detector.h"
+#include "waitgraph.h"
+
+/* This module runs the detector thread.
+ *
+ * oss and the thread take turns on the snapshot through state: oss only
+ * takes a snapshot while the thread is idle, the thread only reads it
+ * between detector_run() and storing D_DONE. Storing state is a release and
+ * loading it an acquire, so each side sees everything the other wrote
+ * before handing over. The thread parks on a futex on state while idle.
+ *
+ * The sets found are of the moment the snapshot was taken. Recovery has to
+ * check them against the live graph, some may be gone already.
+ */
+
+typedef enum { D_IDLE, D_RUNNING, D_DONE, D_STOP } detector_state;
+
+static uint state;
+static pthread_t thread;
+// Results of the last run
+static int *members;
+static int *starts;
+static int nsets;
+static long search_ns;
+
+static int futex(uint *addr, int op, uint val) {
+    return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+static void *detector_main(void *arg) {
+    uint s;
+
+    for (;;) {
+        while ((s = __atomic_load_n(&state, __ATOMIC_ACQUIRE)) == D_IDLE || s == D_DONE)
+            futex(&state, FUTEX_WAIT_PRIVATE, s);
+        if (s == D_STOP)
+            return NULL;
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        nsets = wfg_snapshot_sets(members, starts);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        search_ns = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+
+        // Stopping may have been asked for in the meantime
+        s = D_RUNNING;
+        __atomic_compare_exchange_n(&state, &s, D_DONE, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE);
+    }
+}
+
+/* Starts the thread, after wfg_init() */
+void detector_start() {
+    sigset_t all, old;
+
+    members = malloc(pcb_num * sizeof(int));
+    starts = malloc((pcb_num + 1) * sizeof(int));
+    state = D_IDLE;
+
+    // Signals are for the main thread
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    if (pthread_create(&thread, NULL, detector_main, NULL)) {
+        perror("pthread_create");
+        exit(1);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* Stops the thread, a run in progress is finished and its results thrown away */
+void detector_stop() {
+    if (members == NULL)
+        return;
+    __atomic_store_n(&state, D_STOP, __ATOMIC_RELEASE);
+    futex(&state, FUTEX_WAKE_PRIVATE, 1);
+    pthread_join(thread, NULL);
+    free(members);
+    free(starts);
+    members = starts = NULL;
+}
+
+/* Tells if the thread is still searching, oss mustn't take a snapshot until it's done */
+bool detector_busy() {
+    return __atomic_load_n(&state, __ATOMIC_ACQUIRE) == D_RUNNING;
+}
+
+/* Starts searching the snapshot just taken */
+void detector_run() {
+    __atomic_store_n(&state, D_RUNNING, __ATOMIC_RELEASE);
+    futex(&state, FUTEX_WAKE_PRIVATE, 1);
+}
+
+/* Takes the results of the last run, the same way wfg_deadlocked_sets() returns them,
+ * along with the time it took. Returns -1 if there's nothing new. They stay
+ * valid until the next detector_run(). */
+int detector_sets(int **sets_members, int **sets_starts, long *ns) {
+    if (__atomic_load_n(&state, __ATOMIC_ACQUIRE) != D_DONE)
+        return -1;
+    __atomic_store_n(&state, D_IDLE, __ATOMIC_RELAXED);
+    *sets_members = members;
+    *sets_starts = starts;
+    *ns = search_ns;
+    return nsets;
+}
@@ -0,0 +1,20 @@
+#ifndef DETECTOR_H
+#define DETECTOR_H
+
+#include <stdbool.h>
+
+#include "common.h"
+
+/* Deadlock detection on a thread of its own, for -d. oss copies the wait-for
+ * graph with wfg_snapshot() and hands it over with detector_run(), and the
+ * thread finds the deadlocked sets of the copy while oss goes on granting
+ * and blocking on the live graph.
+ */
+
+void detector_start();
+void detector_stop();
+bool detector_busy();
+void detector_run();
+int detector_sets(int **members, int **starts, long *ns);
+
+#endif
@@ -0,0 +1,116 @@
+#include <stdlib.h>
+
+#include "eventq.h"
+
+/* A binary min-heap of events with the heap position of every slot kept
+ * alongside, so an event can be moved or cancelled in O(log n) without
+ * searching for it. Events due at the same time come out in slot order,
+ * which keeps runs repeatable.
+ */
+
+typedef struct {
+    osstime time;
+    int slot;
+} event;
+
+static event *heap;
+static int count;
+// Index of each slot's event in heap or -1
+static int *pos;
+
+void eventq_init(int slots) {
+    free(heap);
+    free(pos);
+    heap = malloc(slots * sizeof(event));
+    pos = malloc(slots * sizeof(int));
+    count = 0;
+    for (int i = 0; i < slots; i++)
+        pos[i] = -1;
+}
+
+static bool earlier(const event *a, const event *b) {
+    if (a->time != b->time)
+        return a->time < b->time;
+    return a->slot < b->slot;
+}
+
+static void place(int i, event e) {
+    heap[i] = e;
+    pos[e.slot] = i;
+}
+
+static void sift_up(int i) {
+    event e = heap[i];
+    while (i > 0 && earlier(&e, &heap[(i - 1) / 2])) {
+        place(i, heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    place(i, e);
+}
+
+static void sift_down(int i) {
+    event e = heap[i];
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= count)
+            break;
+        if (child + 1 < count && earlier(&heap[child + 1], &heap[child]))
+            child++;
+        if (!earlier(&heap[child], &e))
+            break;
+        place(i, heap[child]);
+        i = child;
+    }
+    place(i, e);
+}
+
+/* Takes the event at heap index i out, filling the hole with the last one */
+static void remove_at(int i) {
+    event last;
+
+    pos[heap[i].slot] = -1;
+    if (--count == i)
+        return;
+    last = heap[count];
+    place(i, last);
+    sift_up(i);
+    sift_down(pos[last.slot]);
+}
+
+/* Schedules slot's event at time, moving it if it's already scheduled */
+void eventq_schedule(int slot, osstime time) {
+    int i = pos[slot];
+
+    if (i == -1) {
+        i = count++;
+        heap[i].slot = slot;
+    }
+    heap[i].time = time;
+    sift_up(i);
+    sift_down(pos[slot]);
+}
+
+void eventq_cancel(int slot) {
+    if (pos[slot] != -1)
+        remove_at(pos[slot]);
+}
+
+bool eventq_scheduled(int slot) {
+    return pos[slot] != -1;
+}
+
+/* Returns the slot of the earliest event and its time, or -1 if there's none */
+int eventq_peek(osstime *time) {
+    if (count == 0)
+        return -1;
+    *time = heap[0].time;
+    return heap[0].slot;
+}
+
+/* Same as eventq_peek(), and takes the event out */
+int eventq_pop(osstime *time) {
+    int slot = eventq_peek(time);
+    if (slot != -1)
+        remove_at(0);
+    return slot;
+}
@@ -0,0 +1,20 @@
+#ifndef EVENTQ_H
+#define EVENTQ_H
+
+#include <stdbool.h>
+
+#include "osstime.h"
+
+/* Timed events of the simulation, earliest first.
+ * Events are identified by slots 0 .. slots-1 and each slot is scheduled at
+ * most once, so scheduling a slot again moves its event.
+ */
+
+void eventq_init(int slots);
+void eventq_schedule(int slot, osstime time);
+void eventq_cancel(int slot);
+bool eventq_scheduled(int slot);
+int eventq_peek(osstime *time);
+int eventq_pop(osstime *time);
+
+#endif
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "types.h"
+
+/* This module implements the log.
+ *
+ * The ring is a bounded multi-producer queue of fixed-size slots. A producer
+ * claims a slot by advancing tail with a compare and swap, formats its line
+ * right into the slot and publishes it by storing the slot's sequence number.
+ * The writer thread is the only consumer: it copies published lines into a
+ * large buffer and writes the buffer out when it's nearly full or when there's
+ * nothing more to read. Nobody takes a lock or makes a system call per line.
+ *
+ * Lines at L_SUMMARY level are never thrown away, they wait for room
+ * whatever the policy is.
+ */
+
+#define LOG_SLOTS 4096
+#define LOG_SLOT_SIZE 512
+#define LOG_WRITE_SIZE (64 * 1024)
+// With LP_SAMPLE one line in LOG_SAMPLE_RATE is kept once the ring is 3/4 full
+#define LOG_SAMPLE_RATE 8
+#define LOG_IDLE_NS 1000000
+
+typedef struct {
+    // Position the slot is free for, or position + 1 once its line is published
+    ulong seq;
+    uint len;
+    char text[LOG_SLOT_SIZE - sizeof(ulong) - sizeof(uint)];
+} log_slot;
+
+static log_slot *slots;
+static ulong head;
+static ulong tail;
+static int fd = -1;
+static log_level min_level = L_SUMMARY;
+static log_policy policy = LP_DROP;
+static pthread_t writer;
+static bool stopping;
+static ulong dropped;
+static ulong sampled_out;
+static ulong sample_counter;
+
+/* Copies every published line to buf and writes it out when full.
+ * Returns the number of lines taken from the ring. */
+static int drain(char *buf, size_t *used) {
+    int lines = 0;
+
+    for (;;) {
+        log_slot *slot = &slots[head % LOG_SLOTS];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != head + 1)
+            break;
+        if (*used + slot->len > LOG_WRITE_SIZE) {
+            if (write(fd, buf, *used) < 0)
+                perror("log write");
+            *used = 0;
+        }
+        memcpy(buf + *used, slot->text, slot->len);
+        *used += slot->len;
+        // Free the slot for the producer that comes around the ring next time
+        __atomic_store_n(&slot->seq, head + LOG_SLOTS, __ATOMIC_RELEASE);
+        // Producers read head for sampling while this runs
+        __atomic_store_n(&head, head + 1, __ATOMIC_RELAXED);
+        lines++;
+    }
+    return lines;
+}
+
+static void *writer_main(void *arg) {
+    char *buf = malloc(LOG_WRITE_SIZE);
+    size_t used = 0;
+    struct timespec idle = { 0, LOG_IDLE_NS };
+
+    for (;;) {
+        bool last = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+        if (drain(buf, &used) > 0)
+            continue;
+        // Nothing more for now, don't keep anything back
+        if (used > 0) {
+            if (write(fd, buf, used) < 0)
+                perror("log write");
+            used = 0;
+        }
+        // stopping was set before the ring was found empty, so everything's out
+        if (last)
+            break;
+        nanosleep(&idle, NULL);
+    }
+    free(buf);
+    return NULL;
+}
+
+/* Opens the log file and starts the writer. Lines below level are ignored. */
+void log_open(const char *path, log_level level, log_policy lp) {
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("log open");
+        exit(1);
+    }
+    min_level = level;
+    policy = lp;
+    slots = malloc(LOG_SLOTS * sizeof(log_slot));
+    for (ulong i = 0; i < LOG_SLOTS; i++)
+        slots[i].seq = i;
+    head = tail = 0;
+    stopping = false;
+    if (pthread_create(&writer, NULL, writer_main, NULL)) {
+        perror("pthread_create");
+        exit(1);
+    }
+}
+
+/* Writes out everything logged so far and closes the file */
+void log_close() {
+    if (fd == -1)
+        return;
+    if (dropped || sampled_out)
+        log_line(L_SUMMARY, "Log: %lu lines dropped, %lu lines left out by sampling", dropped, sampled_out);
+    __atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    close(fd);
+    fd = -1;
+    free(slots);
+}
+
+bool log_enabled(log_level level) {
+    return fd != -1 && level >= min_level;
+}
+
+/* Decides whether a line that's about to be logged at pos is left out */
+static bool sample_out(log_level level, ulong pos) {
+    ulong filled = pos - __atomic_load_n(&head, __ATOMIC_RELAXED);
+
+    if (policy != LP_SAMPLE || level == L_SUMMARY || filled < LOG_SLOTS * 3 / 4)
+        return false;
+    return __atomic_fetch_add(&sample_counter, 1, __ATOMIC_RELAXED) % LOG_SAMPLE_RATE != 0;
+}
+
+/* Claims a slot for a new line, returns NULL if the line is to be thrown away */
+static log_slot *claim(log_level level) {
+    ulong pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+
+    if (sample_out(level, pos)) {
+        __atomic_fetch_add(&sampled_out, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    for (;;) {
+        log_slot *slot = &slots[pos % LOG_SLOTS];
+        long diff = (long)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                return slot;
+        } else if (diff < 0) {
+            // The ring is full
+            if (policy != LP_BLOCK && level != L_SUMMARY) {
+                __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+                return NULL;
+            }
+            sched_yield();
+            pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+        } else {
+            // Another producer took it
+            pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Logs a line, a newline is added */
+void log_vline(log_level level, const char *fmt, va_list ap) {
+    log_slot *slot;
+    int len;
+
+    if (!log_enabled(level) || (slot = claim(level)) == NULL)
+        return;
+
+    len = vsnprintf(slot->text, sizeof(slot->text) - 1, fmt, ap);
+    // Long lines are cut
+    if (len < 0)
+        len = 0;
+    if (len > (int)sizeof(slot->text) - 2)
+        len = sizeof(slot->text) - 2;
+    slot->text[len++] = '\n';
+    slot->len = len;
+    // Position of the slot is seq, publishing it makes it seq + 1
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+void log_line(log_level level, const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    log_vline(level, fmt, ap);
+    va_end(ap);
+}
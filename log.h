@@ -0,0 +1,37 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+
+/* Buffered log shared by oss and user processes.
+ * Lines are formatted into an in-memory ring by the caller and written to the
+ * file in large chunks by a writer thread.
+ */
+
+typedef enum {
+    // Traces of user processes
+    L_DEBUG,
+    // What oss does, printed with -v
+    L_VERBOSE,
+    // Deadlocks and final statistics, always printed
+    L_SUMMARY
+} log_level;
+
+/* What to do with a line when the ring is full */
+typedef enum {
+    // Throw it away
+    LP_DROP,
+    // Wait for the writer to make room
+    LP_BLOCK,
+    // Keep only some lines once the ring is filling up, throw away the rest when full
+    LP_SAMPLE
+} log_policy;
+
+void log_open(const char *path, log_level level, log_policy policy);
+void log_close();
+bool log_enabled(log_level level);
+void log_line(log_level level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void log_vline(log_level level, const char *fmt, va_list ap);
+
+#endif
@@ -9,17 +9,32 @@
 typedef enum {
     ANY,
 // oss -> user
-    PROCESS, ALLOCATE,
+    PROCESS, ALLOCATE, RESET, ALLOCATE_MANY,
 // user -> oss
-    REQUEST, RELEASE, IDLE, RELEASE_ALL_AND_TERMINATE
+    REQUEST, RELEASE, IDLE, RELEASE_ALL_AND_TERMINATE, REQUEST_MANY, RELEASE_MANY
 } message_type;
 
+// Most resources a REQUEST_MANY or RELEASE_MANY names
+#define MSG_MAX_ITEMS 4
+
+typedef struct {
+    int res_id;
+    int units;
+} res_amount;
+
 typedef struct {
     union {
         message_type type;
         long _msgtyp;
     };
     int res_id;
+    // REQUEST_MANY, RELEASE_MANY and ALLOCATE_MANY: units of distinct resources, all or nothing
+    int nitems;
+    res_amount items[MSG_MAX_ITEMS];
+    // RESET: random seed of the new user
+    uint seed;
+    // Replies to PROCESS: when the user wants to run next
+    osstime next;
 } ipc_message;
 
 extern const size_t msg_size;
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "ring.h"
+#include "mlfq.h"
+
+/* Every level is a ring of ready processes, and a bitmap tells which levels
+ * have any, so picking the next process is finding its lowest set bit and
+ * popping that ring. A process is in at most one ring at a time, except that
+ * a process cleaned up while it was ready leaves its entry behind: entries
+ * carry the ticket the process got when it became ready and the ones that
+ * don't match anymore are skipped when they come up.
+ *
+ * Processes stuck at the bottom while the levels above keep busy would never
+ * run, so every MLFQ_BOOST of simulated time all normal processes go back to
+ * level 1.
+ */
+
+#define BASE_QUANTUM 10000
+#define MLFQ_BOOST (100 * BASE_QUANTUM)
+
+typedef struct {
+    int pid;
+    uint ticket;
+} run_entry;
+
+RING(runq, run_entry)
+
+static runq levels[MLFQ_LEVELS];
+// Bit l is set while levels[l] isn't empty
+static uint nonempty;
+static arena overflow;
+static void *overflow_mem;
+
+static int *level;
+static bool *realtime;
+static bool *queued;
+static uint *ticket;
+static osstime next_boost;
+
+/* statistics */
+long mlfq_turns[MLFQ_LEVELS];
+int mlfq_demotions = 0;
+int mlfq_promotions = 0;
+int mlfq_boosts = 0;
+
+/* Real-time processes get short turns often, normal ones longer turns the lower they are */
+static osstime quantum(int l) {
+    return l == 0 ? BASE_QUANTUM : (osstime)BASE_QUANTUM << l;
+}
+
+void mlfq_init(int pcbs) {
+    uint size = 1;
+    // Slots for every process on each level, overflow only holds entries left behind
+    int chunks = pcbs / RING_CHUNK_ITEMS + MLFQ_LEVELS;
+    size_t chunk = (sizeof(runq_chunk) + 15) / 16 * 16;
+
+    while (size < (uint)pcbs)
+        size <<= 1;
+    overflow_mem = malloc(chunks * chunk);
+    arena_init(&overflow, overflow_mem, chunks * chunk, sizeof(runq_chunk));
+    for (int l = 0; l < MLFQ_LEVELS; l++)
+        runq_init(&levels[l], malloc(size * sizeof(run_entry)), size, &overflow);
+    nonempty = 0;
+
+    level = calloc(pcbs, sizeof(int));
+    realtime = calloc(pcbs, sizeof(bool));
+    queued = calloc(pcbs, sizeof(bool));
+    ticket = calloc(pcbs, sizeof(uint));
+    next_boost = clock_now() + MLFQ_BOOST;
+}
+
+/* Puts a process that has just been spawned at the top level of its class */
+void mlfq_start(int pid, bool is_realtime) {
+    realtime[pid] = is_realtime;
+    level[pid] = is_realtime ? 0 : 1;
+}
+
+static void enqueue(int l, int pid) {
+    run_entry e = { pid, ticket[pid] };
+
+    if (!runq_push(&levels[l], e)) {
+        fprintf(stderr, "mlfq: run queue overflow\n");
+        exit(1);
+    }
+    nonempty |= 1u << l;
+}
+
+/* Called when pid's turn has come, it runs when no process above it is ready */
+void mlfq_ready(int pid) {
+    queued[pid] = true;
+    ticket[pid]++;
+    enqueue(level[pid], pid);
+}
+
+bool mlfq_queued(int pid) {
+    return queued[pid];
+}
+
+/* Forgets pid's turn, its entry is skipped when it comes up */
+void mlfq_cancel(int pid) {
+    queued[pid] = false;
+}
+
+/* Moves every normal process to level 1, keeping the order of ready ones */
+static void boost() {
+    run_entry e;
+
+    for (int l = 2; l < MLFQ_LEVELS; l++) {
+        while (runq_pop(&levels[l], &e))
+            if (queued[e.pid] && ticket[e.pid] == e.ticket)
+                enqueue(1, e.pid);
+        nonempty &= ~(1u << l);
+    }
+    for (int pid = 0; pid < pcb_num; pid++)
+        if (!realtime[pid])
+            level[pid] = 1;
+    mlfq_boosts++;
+}
+
+/* Takes the next process to run and its quantum, or returns -1 if nobody is ready */
+int mlfq_pick(osstime *q) {
+    run_entry e;
+
+    if (clock_now() >= next_boost) {
+        boost();
+        next_boost = clock_now() + MLFQ_BOOST;
+    }
+    while (nonempty) {
+        int l = __builtin_ctz(nonempty);
+        bool popped = runq_pop(&levels[l], &e);
+        if (runq_empty(&levels[l]))
+            nonempty &= ~(1u << l);
+        if (!popped || !queued[e.pid] || ticket[e.pid] != e.ticket)
+            continue;
+        queued[e.pid] = false;
+        mlfq_turns[l]++;
+        *q = quantum(l);
+        return e.pid;
+    }
+    return -1;
+}
+
+/* Moves pid after a turn: up if it got blocked, down if it used its whole quantum */
+void mlfq_feedback(int pid, bool blocked, bool used_quantum) {
+    if (realtime[pid])
+        return;
+    if (blocked && level[pid] > 1) {
+        level[pid]--;
+        mlfq_promotions++;
+    } else if (used_quantum && level[pid] < MLFQ_LEVELS - 1) {
+        level[pid]++;
+        mlfq_demotions++;
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef MLFQ_H
+#define MLFQ_H
+
+#include <stdbool.h>
+
+#include "osstime.h"
+
+/* Multi-level feedback queues deciding which process whose turn has come
+ * runs next, for the -q mode of oss. Level 0 belongs to real-time processes,
+ * which stay there. Normal processes start at level 1 and go down a level
+ * whenever they use up a whole quantum and up one whenever they get blocked.
+ * Lower levels get longer quanta but only run when the levels above have
+ * nobody ready.
+ */
+
+#define MLFQ_LEVELS 4
+
+void mlfq_init(int pcbs);
+void mlfq_start(int pid, bool realtime);
+void mlfq_ready(int pid);
+bool mlfq_queued(int pid);
+void mlfq_cancel(int pid);
+int mlfq_pick(osstime *quantum);
+void mlfq_feedback(int pid, bool blocked, bool used_quantum);
+
+/* Turns given at every level, level changes and periodic boosts */
+extern long mlfq_turns[MLFQ_LEVELS];
+extern int mlfq_demotions;
+extern int mlfq_promotions;
+extern int mlfq_boosts;
+
+#endif
@@ -6,129 +6,148 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
-#include <sys/msg.h>
 #include <sys/shm.h>
 #include <sys/wait.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <time.h>
+#include <sys/prctl.h>
 
 #include "common.h"
 #include "messages.h"
-#include "queue.h"
 #include "osstime.h"
+#include "banker.h"
+#include "resmgr.h"
+#include "channel.h"
+#include "behaviour.h"
+#include "log.h"
+#include "trace.h"
+#include "eventq.h"
+#include "partition.h"
+#include "mlfq.h"
 
 /* constants */
 
-#define PERMS 0666
-
 // Ratio of normal processes per each rt process
 #define NORMAL_PROCS 4
 
-#define BASE_QUANTUM 10000
+// Longest message logprintf() formats
+#define LOG_MSG_SIZE 1024
 
 /* global variables */
-bool verbose = false;
+log_level log_min_level = L_SUMMARY;
+log_policy log_backpressure = LP_BLOCK;
+// Binary trace file, NULL if not tracing
+const char *trace_path = NULL;
+// Statistics snapshots written with -S and -M, NULL if not exporting
+const char *stats_csv_path = NULL;
+const char *stats_om_path = NULL;
+// Trace being replayed with -R
+const char *replay_path = NULL;
+trace_header *replay_hdr;
+trace_event *replay_events;
+ulong replay_count;
+// Seed of oss's random numbers, -1 to use the pid
+long seed = -1;
+transport_type transport = T_MSGQ;
+// Users ask for and give back several resources in one message, granted all or nothing
+bool batch_requests = false;
+// Back the segment with huge pages and have every process fault it in when mapping it
+bool huge_pages = false;
+bool prefault_segment = false;
+// Process cleaning up after oss however it ends and the pipe it waits on, see start_reaper()
+pid_t reaper = -1;
+int reaper_pipe = -1;
+bool lockstep = false;
+// Run one process at a time picked by multi-level feedback queues, see mlfq.c
+bool mlfq_scheduling = false;
+// Manager threads the resources are split among with -m, 0 to decide everything on the main thread
+int manager_threads = 0;
+
+/* Where user processes run: forked ./user processes, a pool of ./user workers
+ * forked at start and reset for every new user, state machines inside oss
+ * or nowhere, replaying what they did in a trace */
+typedef enum { E_FORK, E_POOL, E_INPROC, E_REPLAY } engine_type;
+engine_type engine = E_FORK;
+// taken[] value of an in-process or replayed user, there's no real process to signal or wait for
+#define INPROC_TAKEN -1
+user_state *users;
+ipc_message *inproc_replies;
+// Pool engine: worker process of each PCB
+pid_t *workers;
 uint max_run_time = 3;
-int childrenLimit = PCB_NUM;
+int childrenLimit;
 bool running = true;
-FILE* log_file;
-uint log_lines = 0;
-int taken[PCB_NUM];
+int *taken;
 osstime next_proc;
-osstime next_dedeadlock;
-
-queue queues[4];
+// When each process wants to run next, as it said in its last reply
+osstime *next_action;
+// Event slots are the PCBs, for their next turns, and then spawning
+#define SPAWN_EVENT pcb_num
+// Processes that asked to terminate while the managers were busy, see settle()
+int *terminating;
+int nterminating = 0;
 
 /* statistics */
-int requests_granted = 0;
 int killed_procs = 0;
 int terminated_procs = 0;
-int dedeadlocks_run = 0;
+int spawns = 0;
+long spawn_ns = 0;
+long request_msgs = 0;
+long release_msgs = 0;
 
 /* function prototypes */
 int find_free_pid();
 void spawn_process(int pid_to_spawn);
 void cleanup_processes();
+void start_workers();
+void stop_workers();
 void cleanup_process(int pid);
 void signalHandler(int sig);
+void claims_declared(uint pid);
+void replay_check();
+void settle(int *batch, int nbatch);
+void start_reaper();
+void stop_reaper();
 
-/* Prints a log line.
+/* Prints a log line in verbose mode.
  * time - add "at xxx:yyy" to the end of message
  * fmt - format string
  */
 void logprintf(bool time, const char *fmt, ...) {
 	va_list ap;
+    char msg[LOG_MSG_SIZE];
 
-    if (!verbose)
+    if (!log_enabled(L_VERBOSE))
         return;
 
-	/* Don't print more than 100000 lines */
-	if (log_lines > 100000)
-		return;
-
-	log_lines++;
-
-    fprintf(log_file, "OSS: ");
-	/* Print the message */
 	va_start(ap, fmt);
-    vfprintf(log_file, fmt, ap);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
 	va_end(ap);
 	/* Append current time if needed */
 	if (time)
-        fprintf(log_file, " at time %d:%d", shm->cpu_clock.sec, shm->cpu_clock.usec);
-    fprintf(log_file, "\n");
-    fflush(log_file);
+        log_line(L_VERBOSE, "OSS: %s at time " OSSTIME_FMT, msg, OSSTIME_ARGS(clock_now()));
+    else
+        log_line(L_VERBOSE, "OSS: %s", msg);
 }
 
+/* Prints a log line whatever the log level is */
 void forcelogprintf(const char *fmt, ...) {
 	va_list ap;
+    char msg[LOG_MSG_SIZE];
 
-	log_lines++;
-
-    fprintf(log_file, "OSS: ");
-    /* Print the message */
 	va_start(ap, fmt);
-    vfprintf(log_file, fmt, ap);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
 	va_end(ap);
-    fprintf(log_file, "\n");
-    fflush(log_file);
-}
-
-void printres() {
-
-    if (!verbose)
-        return;
-
-    // shareable
-    fprintf(log_file, "        ");
-    for (int res = 0; res < RESOURCE_NUM; res++)
-        fprintf(log_file, shm->resources[res].shared ? "s   " : "ns  ");
-    fprintf(log_file, "\n");
-    log_lines++;
-
-    // Header row
-    fprintf(log_file, "bl      ");
-    for (int res = 0; res < RESOURCE_NUM; res++)
-        fprintf(log_file, "R%-3d", res);
-    fprintf(log_file, "\n");
-    log_lines++;
-
-    // Table
-    for (int pid = 0; pid < PCB_NUM; pid++) {
-        if (shm->pcbs[pid].state == S_BLOCKED)
-            fprintf(log_file, "%-4dP%-3d", shm->pcbs[pid].blocked_on, pid);
-        else
-            fprintf(log_file, "    P%-3d", pid);
-        for (int res = 0; res < RESOURCE_NUM; res++)
-            fprintf(log_file, "%-4d", shm->resources[res].allocated[pid]);
-        fprintf(log_file, "\n");
-        log_lines++;
-    }
+    log_line(L_SUMMARY, "OSS: %s", msg);
 }
 
 void kill_process(int pid)
 {
-    kill(taken[pid], SIGUSR1);
+    // A pool worker is just left waiting for its next RESET
+    if (engine == E_FORK)
+        kill(taken[pid], SIGUSR1);
+    trace(TR_KILL, pid, -1, 0);
     killed_procs++;
     cleanup_process(pid);
 }
@@ -151,46 +170,152 @@ void init() {
 		exit(1);
 	}
 
-	/* start alarm timer */
-    alarm(max_run_time);
+	/* start alarm timer, a replay runs to the end of its trace */
+    if (engine != E_REPLAY)
+        alarm(max_run_time);
 
-    log_file = fopen("log.txt", "w");
+    log_open("log.txt", log_min_level, log_backpressure);
 
-    srand(getpid());
+    srand(seed >= 0 ? seed : getpid());
 
-    /* shared memory allocation and attach */
-    allocate();
-	attach();
+    // A replay runs with the dimensions and options of the recorded run
+    if (engine == E_REPLAY) {
+        replay_events = trace_map(replay_path, &replay_hdr, &replay_count);
+        pcb_num = replay_hdr->pcb_num;
+        resource_num = replay_hdr->resource_num;
+        avoidance = replay_hdr->flags & TRF_AVOIDANCE;
+        priority_wakeup = replay_hdr->flags & TRF_PRIORITY_WAKEUP;
+        victim_cost = victim_policies[replay_hdr->victim_policy].cost;
+    }
 
-    // Init shm
-    memset(shm, 0, sizeof(struct shm_data_t));
+    /* shared memory allocation and attach, sized for -p and -r */
+    struct shm_data_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.avoidance = avoidance;
+    hdr.transport = transport;
+    hdr.log_min_level = log_min_level;
+    hdr.batch_requests = batch_requests;
+    hdr.prefault = prefault_segment;
+    size_t size = layout_plan(&hdr);
+    bool reserved_huge = allocate(size, huge_pages);
+    attach();
+
+    // Init shm, which faults in every page of oss's mapping as well
+    memset(shm, 0, shm_size);
+    *shm = hdr;
+    layout_map();
+    channel_init();
+    start_reaper();
+    // Children find the segment through the descriptor they inherit
+    char fd_str[16];
+    sprintf(fd_str, "%d", shm_fd);
+    setenv(SHM_FD_ENV, fd_str, 1);
+    // A replay traces itself to check it does the same as the recorded run
+    if (trace_path || engine == E_REPLAY) {
+        trace_header *th = trace_open(trace_path);
+        th->flags = (avoidance ? TRF_AVOIDANCE : 0) | (priority_wakeup ? TRF_PRIORITY_WAKEUP : 0);
+        for (int i = 0; victim_policies[i].name; i++)
+            if (victim_policies[i].cost == victim_cost)
+                th->victim_policy = i;
+    }
+    logprintf(false, "Shared memory of %zu bytes for %d PCBs and %d resources, %s holder data, %s pages",
+            size, pcb_num, resource_num, shm->sparse ? "sparse" : "dense",
+            reserved_huge ? "reserved huge" : huge_pages ? "transparent huge" : "normal");
+
+    resmgr_init();
+    stats_open(stats_csv_path, stats_om_path);
 
-    // Init resources
-    for (int i = 0; i < RESOURCE_NUM; i++) {
+    // Init resources, a replay finds them in the trace
+    for (int i = 0; i < resource_num && engine != E_REPLAY; i++) {
         // 20% of the resources are shareable
-        shm->resources[i].shared = chance(20);
-        logprintf(false, "Initializing %s Resource R%d.", shm->resources[i].shared ? "shareable" : "non-shareable", i);
+        res_info[i].shared = chance(20);
+        logprintf(false, "Initializing %s Resource R%d.", res_info[i].shared ? "shareable" : "non-shareable", i);
         // Limits are 1-10
-        shm->resources[i].limit = (rnd(1, 10));
+        res_info[i].limit = (rnd(1, RES_MAX_LIMIT));
+        trace(TR_RESOURCE, res_info[i].shared, i, res_info[i].limit);
+    }
+
+    // Data kept by oss for each PCB
+    childrenLimit = pcb_num;
+    taken = calloc(pcb_num, sizeof(int));
+    next_action = calloc(pcb_num, sizeof(osstime));
+    eventq_init(pcb_num + 1);
+    if (mlfq_scheduling)
+        mlfq_init(pcb_num);
+    if (engine == E_INPROC) {
+        users = calloc(pcb_num, sizeof(user_state));
+        inproc_replies = calloc(pcb_num, sizeof(ipc_message));
+    }
+    if (manager_threads) {
+        terminating = calloc(pcb_num, sizeof(int));
+        partition_start(manager_threads);
+        logprintf(false, "Resources split among %d manager threads", manager_threads);
     }
 
 	/* Some data structures */
-	next_proc.sec = 0;
-	next_proc.usec = 0;
-    next_dedeadlock.sec = 1;
-    next_dedeadlock.usec = 0;
+	next_proc = 0;
+
+    if (engine == E_POOL)
+        start_workers();
 }
 
 void uninit() {
-    fclose(log_file);
+    // Managers finish what they were given, cleaning up then happens on this thread alone
+    partition_stop();
+    resmgr_shutdown();
+    stats_close();
     cleanup_processes();
+    if (engine == E_REPLAY)
+        replay_check();
+    trace_close();
+    log_close();
     deallocate();
+    stop_reaper();
+}
+
+/* Forks a process that cleans up after oss, however oss ends. It waits for
+ * the pipe from oss to close, which the kernel does when oss exits or
+ * crashes, and removes the message queues left open. Users go away with oss
+ * on their own (see fork_user()) and the segment with its last user.
+ */
+void start_reaper()
+{
+    int fds[2];
+    char c;
+    ssize_t n;
+
+    EXIT_ON_ERROR(pipe(fds), "pipe")
+    // Users mustn't keep the pipe open after oss is gone
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    reaper = fork();
+    EXIT_ON_ERROR(reaper, "fork")
+    if (reaper == 0) {
+        close(fds[1]);
+        // Otherwise pkill -x oss or killall oss would take it down with oss
+        prctl(PR_SET_NAME, "oss-reaper");
+        // ^C goes to the whole process group, oss has to go first
+        signal(SIGINT, SIG_IGN);
+        signal(SIGTERM, SIG_IGN);
+        while ((n = read(fds[0], &c, 1)) > 0 || (n == -1 && errno == EINTR))
+            ;
+        channel_reap();
+        _exit(0);
+    }
+    close(fds[0]);
+    reaper_pipe = fds[1];
+}
+
+/* Lets the reaper go, with nothing left for it to clean up */
+void stop_reaper()
+{
+    close(reaper_pipe);
+    waitpid(reaper, NULL, 0);
 }
 
 /* Count actually existing children */
 int count_children() {
 	int count = 0;
-	for (int i = 0; i < PCB_NUM; ++i) {
+	for (int i = 0; i < pcb_num; ++i) {
 		if (taken[i] != 0)
 			count++;
 	}
@@ -201,225 +326,641 @@ void schedule_proc_spawn()
 {
     int next_proc_rnd = rnd(1, 500);
     osstime_advance(&next_proc, next_proc_rnd);
+    eventq_schedule(SPAWN_EVENT, next_proc);
 }
 
 void maybe_spawn_process()
 {
-    if (osstime_cmp(&next_proc, &shm->cpu_clock) <= 0) {
-        int new_pid = find_free_pid();
-        // Skip making a process if already reached limit
-        if (new_pid != -1)
-            spawn_process(new_pid);
-        schedule_proc_spawn();
-    }
+    int new_pid = find_free_pid();
+    // Skip making a process if already reached limit
+    if (new_pid != -1)
+        spawn_process(new_pid);
+    schedule_proc_spawn();
 }
 
-int resource_total_allocated(int res_id)
+/* Tells if pid's next turn is coming already, in the event queue or waiting in the feedback queues */
+bool turn_pending(uint pid)
 {
-    int total = 0;
-    for (int i = 0; i < PCB_NUM; i++) {
-        total += shm->resources[res_id].allocated[i];
-    }
-    return total;
+    return eventq_scheduled(pid) || (mlfq_scheduling && mlfq_queued(pid));
 }
 
-void block_process(uint pid, int res_id)
+/* Schedules pid's next turn for when it asked, or now if that has passed */
+void schedule_user(uint pid)
 {
-    logprintf(false, "Blocking process P%d waiting on resource R%d", pid, res_id);
-    shm->pcbs[pid].state = S_BLOCKED;
-    shm->pcbs[pid].blocked_on = res_id;
-    osstime_advance(&shm->cpu_clock, rnd(10, 50));
+    eventq_schedule(pid, osstime_max(next_action[pid], clock_now()));
 }
 
-void allocate_resource(uint pid, int res_id)
+/* In-process users handle messages right away, a reply to PROCESS is kept
+ * until oss asks for it */
+void inproc_deliver(uint pid, ipc_message *msg)
 {
-    pcb *p = &shm->pcbs[pid];
-    ipc_message msg;
-    msg._msgtyp = 0;
-    shm->resources[res_id].allocated[pid]++;
-
-    msg.type = ALLOCATE;
-    msg.res_id = res_id;
-    msgsnd(p->msq_to_user, &msg, msg_size, 0);
-    osstime_advance(&shm->cpu_clock, rnd(1, 10));
-    logprintf(true, "Master granting P%d request R%d", pid, res_id);
-
-    requests_granted++;
-    if (requests_granted % 20 == 0)
-        printres();
+    switch (msg->type) {
+    case PROCESS:
+        behaviour_step(&users[pid], &inproc_replies[pid]);
+        break;
+    case ALLOCATE:
+    case ALLOCATE_MANY:
+        behaviour_allocated(&users[pid], msg);
+        break;
+    default:
+        break;
+    }
 }
 
-void unblock_process(uint pid, int res_id)
+void send_to_user(uint pid, ipc_message *msg)
 {
-    logprintf(false, "Unblocking Process P%d, and granting it Resource R%d", pid, res_id);
-    shm->pcbs[pid].state = S_ACTIVE;
-    shm->pcbs[pid].blocked_on = -1;
-    osstime_advance(&shm->cpu_clock, rnd(1, 50));
-    allocate_resource(pid, res_id);
+    bool granted = msg->type == ALLOCATE || msg->type == ALLOCATE_MANY;
+
+    // A process woken up by a grant gets its turns again, managers leave it to settle()
+    if (granted && partition_thread())
+        partition_granted(pid);
+    else if (granted && pcb_state(pid) == S_ACTIVE && !turn_pending(pid))
+        schedule_user(pid);
+
+    if (engine == E_INPROC)
+        inproc_deliver(pid, msg);
+    else if (engine != E_REPLAY)
+        channel_send(pid, TO_USER, msg);
 }
 
-void resource_requested(uint pid, int res_id)
+/* Takes the maximum claims pid has declared into account from now on, and traces them */
+void claims_declared(uint pid)
 {
-    // Non-shared resource
-    if (resource_total_allocated(res_id) - shm->resources[res_id].allocated[pid] > 0) {
-        block_process(pid, res_id);
+    if (!avoidance || pcbs[pid].claims_known)
         return;
-    }
-
-    // Limit reached
-    if (resource_total_allocated(res_id) >= shm->resources[res_id].limit) {
-        block_process(pid, res_id);
+    pcbs[pid].claims_known = true;
+    if (trace_events == NULL)
         return;
-    }
-
-    // Everything's fine
-    allocate_resource(pid, res_id);
+    for (int i = 0; i < resource_num; i++)
+        if (claim_column(i)[pid] > 0)
+            trace(TR_CLAIM, pid, i, claim_column(i)[pid]);
 }
 
-void wake_up_on_resource(int res_id)
+void process_terminated(uint pid)
 {
-    int start = rand() % PCB_NUM;
-    for (int i = (start+1)%PCB_NUM; i != start; i = (i+1)%PCB_NUM)
-        if (shm->pcbs[i].state == S_BLOCKED &&
-                shm->pcbs[i].blocked_on == res_id)
-            if (shm->resources[res_id].shared ||
-                    resource_total_allocated(res_id) == 0) {
-                unblock_process(i, res_id);
-                if (!shm->resources[res_id].shared)
-                    return;
-            }
-}
-
-void resource_released(uint pid, int res_id)
-{
-    shm->resources[res_id].allocated[pid]--;
-    wake_up_on_resource(res_id);
+    logprintf(true, "Process P%d terminating normally", pid);
+    terminated_procs++;
+    trace(TR_TERMINATE, pid, -1, 0);
+    cleanup_process(pid);
 }
 
-void process(uint pid)
+/* Tells a process to do its thing */
+void dispatch(uint pid)
 {
-    pcb *p = &shm->pcbs[pid];
     ipc_message msg;
     msg._msgtyp = 0;
     msg.type = PROCESS;
-    msgsnd(p->msq_to_user, &msg, msg_size, 0);
-    if (-1 == msgrcv(p->msq_to_oss, &msg, msg_size, 0, 0)) {
+    send_to_user(pid, &msg);
+}
+
+/* Waits for a process's reply to PROCESS, returns false if interrupted */
+bool receive_reply(uint pid, ipc_message *msg)
+{
+    if (engine == E_INPROC) {
+        *msg = inproc_replies[pid];
+        return true;
+    }
+    if (-1 == channel_recv(pid, TO_OSS, msg)) {
         if (errno == EINTR)
-            return;
-        perror("msgrcv");
+            return false;
+        perror("channel_recv");
         exit(1);
     }
-    switch (msg.type) {
+    return true;
+}
+
+void handle_reply(uint pid, ipc_message *msg)
+{
+    // A forked user has surely declared its claims by the time it replies
+    claims_declared(pid);
+    next_action[pid] = msg->next;
+    switch (msg->type) {
     case REQUEST:
-        logprintf(true, "Master has detected Process P%d requesting R%d", pid, msg.res_id);
-        resource_requested(pid, msg.res_id);
+        request_msgs++;
+        logprintf(true, "Master has detected Process P%d requesting R%d", pid, msg->res_id);
+        if (manager_threads)
+            partition_request(pid, msg->res_id);
+        else
+            resource_requested(pid, msg->res_id);
         break;
     case RELEASE:
-        logprintf(true, "Master has acknowledged Process P%d releasing R%d", pid, msg.res_id);
-        resource_released(pid, msg.res_id);
+        release_msgs++;
+        logprintf(true, "Master has acknowledged Process P%d releasing R%d", pid, msg->res_id);
+        if (manager_threads)
+            partition_release(pid, msg->res_id);
+        else
+            resource_released(pid, msg->res_id);
+        break;
+    case REQUEST_MANY:
+        request_msgs++;
+        logprintf(true, "Master has detected Process P%d requesting %d resources at once", pid, msg->nitems);
+        resources_requested(pid, msg->items, msg->nitems);
+        break;
+    case RELEASE_MANY:
+        release_msgs++;
+        logprintf(true, "Master has acknowledged Process P%d releasing %d resources at once", pid, msg->nitems);
+        resources_released(pid, msg->items, msg->nitems);
         break;
     case IDLE:
         break;
     case RELEASE_ALL_AND_TERMINATE:
-        logprintf(true, "Process P%d terminating normally", pid);
-        terminated_procs++;
-        cleanup_process(pid);
+        // Its resources may belong to any manager, they all have to stand still first
+        if (manager_threads)
+            terminating[nterminating++] = pid;
+        else
+            process_terminated(pid);
         break;
     default:
-        fprintf(stderr, "Unknown message type in oss: %d", msg.type);
+        fprintf(stderr, "Unknown message type in oss: %d", msg->type);
         exit(1);
     }
-    osstime_advance(&shm->cpu_clock, rnd(1, 10));
+    clock_advance(rnd(1, 10));
+    // A blocked process gets its next turn when it's woken up, with managers settle() schedules it
+    if (!manager_threads && pcb_state(pid) == S_ACTIVE)
+        schedule_user(pid);
 }
 
-void dedeadlock()
+/* With manager threads, waits until they have handled everything routed to
+ * them and then does what has to see all resources standing still: the
+ * terminations, deadlock detection for every process the managers blocked
+ * and the next turns of the processes in batch and of those granted units.
+ */
+void settle(int *batch, int nbatch)
 {
-    bool visited[PCB_NUM];
-    memset(visited, false, sizeof(visited));
+    int blocked[pcb_num], granted[pcb_num];
+    int nblocked, ngranted;
+
+    if (!manager_threads)
+        return;
+    partition_sync(blocked, &nblocked, granted, &ngranted);
+
+    for (int i = 0; i < nterminating; i++)
+        process_terminated(terminating[i]);
+    nterminating = 0;
+
+    // Recovering from one deadlock may have woken up or killed the processes of a later one
+    for (int i = 0; i < nblocked; i++)
+        if (pcb_state(blocked[i]) == S_BLOCKED)
+            dedeadlock(blocked[i]);
+
+    for (int i = 0; i < nbatch; i++)
+        if (pcb_state(batch[i]) == S_ACTIVE && !turn_pending(batch[i]))
+            schedule_user(batch[i]);
+    for (int i = 0; i < ngranted; i++)
+        if (pcb_state(granted[i]) == S_ACTIVE && !turn_pending(granted[i]))
+            schedule_user(granted[i]);
+}
 
-    osstime_advance(&shm->cpu_clock, rnd(50, 100));
-    forcelogprintf("Master running deadlock detection at %d:%d", shm->cpu_clock.sec, shm->cpu_clock.usec);
+/* Runs one process and handles its reply before anybody else runs */
+void process(uint pid)
+{
+    ipc_message msg;
 
-    queue *next = make_queue();
-    for (int i = 0; i < PCB_NUM; i++)
-        if (shm->pcbs[i].state == S_BLOCKED) {
-            enqueue(next, i);
-            break;
-        }
-    while (!queue_empty(next)) {
-        uint npid = dequeue(next);
-        int critical_resource = shm->pcbs[npid].blocked_on;
-        visited[npid] = true;
-        for (int i = 0; i < PCB_NUM; i++) {
-            if (shm->resources[critical_resource].allocated[i] && i != npid) {
-                if (visited[i]) {
-                    forcelogprintf("Process P%d is part of a deadlock", i);
-                    kill_process(i);
-                    dedeadlock();
-                    return;
-                }
-                if (shm->pcbs[i].state == S_BLOCKED)
-                    enqueue(next, i);
-            }
-        }
+    dispatch(pid);
+    if (receive_reply(pid, &msg)) {
+        int batch = pid;
+        handle_reply(pid, &msg);
+        settle(&batch, 1);
     }
-    osstime_advance(&shm->cpu_clock, rnd(50, 100));
-    forcelogprintf("System not in deadlock");
-    free_queue(next);
 }
 
-void maint() {
-    bool have_running_process = false;
-	// Spawn new processes
-    maybe_spawn_process();
-
-    // Tell all processes to do their things
-    for (int i = 0; i < PCB_NUM && running; i++)
-        if (shm->pcbs[i].state == S_ACTIVE) {
-            process(i);
-            have_running_process = true;
-        }
+/* Tells every process whose turn has come to do its thing at once, so they
+ * run concurrently, then handles the replies in the order the turns came.
+ * With manager threads the requests and releases of the whole batch are
+ * decided concurrently too.
+ */
+void process_due()
+{
+    int due[pcb_num], ndue = 0, pid;
+    ipc_message replies[pcb_num];
+    osstime when;
+
+    while ((pid = eventq_peek(&when)) != -1 && pid != SPAWN_EVENT && when <= clock_now()) {
+        eventq_pop(&when);
+        due[ndue++] = pid;
+        dispatch(pid);
+    }
+
+    // Collecting in order only waits for the slowest process
+    for (int i = 0; i < ndue; i++)
+        if (!receive_reply(due[i], &replies[i]))
+            return;
+
+    for (int i = 0; i < ndue && running; i++) {
+        // Skip processes terminated while handling an earlier reply
+        if (pcb_state(due[i]) == S_NOT_STARTED)
+            continue;
+        handle_reply(due[i], &replies[i]);
+    }
+    settle(due, ndue);
+}
+
+/* -q: runs the process the feedback queues picked for one turn. A process
+ * that only computed used its whole quantum, the clock moves past it and
+ * the process goes down a level, one that got blocked goes up a level.
+ */
+void process_mlfq(int pid, osstime quantum)
+{
+    ipc_message msg;
+    bool used_quantum;
+
+    dispatch(pid);
+    if (!receive_reply(pid, &msg))
+        return;
+    used_quantum = msg.type == IDLE;
+    handle_reply(pid, &msg);
+    settle(&pid, 1);
+    if (pcb_state(pid) == S_NOT_STARTED)
+        return;
+    if (used_quantum)
+        clock_advance(quantum);
+    mlfq_feedback(pid, pcb_state(pid) == S_BLOCKED, used_quantum);
+}
+
+/* -q: turns that have come wait in the feedback queues until they're picked,
+ * the clock only jumps to the next event when nobody is ready.
+ */
+void maint_mlfq()
+{
+    osstime when, quantum;
+    int slot, pid;
 
-    // Run deadlock detection algorithm
-    if (osstime_cmp(&next_dedeadlock, &shm->cpu_clock) <= 0) {
-        dedeadlocks_run++;
-        dedeadlock();
-        osstime_advance(&next_dedeadlock, 100000000);
+    while ((slot = eventq_peek(&when)) != -1 && when <= clock_now()) {
+        eventq_pop(&when);
+        if (slot == SPAWN_EVENT)
+            maybe_spawn_process();
+        else
+            mlfq_ready(slot);
     }
 
-    osstime_advance(&shm->cpu_clock, rnd(10, 50));
+    if ((pid = mlfq_pick(&quantum)) != -1)
+        process_mlfq(pid, quantum);
+    else if (eventq_peek(&when) != -1)
+        clock_set(when);
+}
 
-    // Speed up time to spawning more processes and/or deadlock resolution if no running processes
-    if (!have_running_process)
-        osstime_advance(&shm->cpu_clock, 10000);
+/* Moves the clock straight to the next event and handles what's due then.
+ * Nothing happens in between, so idle stretches of simulated time are free.
+ */
+void maint() {
+    osstime when;
+    int slot;
+
+    resmgr_poll();
+    if (mlfq_scheduling) {
+        maint_mlfq();
+        return;
+    }
+    slot = eventq_peek(&when);
+
+    if (when > clock_now())
+        clock_set(when);
+
+    if (slot == SPAWN_EVENT) {
+        eventq_pop(&when);
+        maybe_spawn_process();
+    } else if (lockstep) {
+        eventq_pop(&when);
+        process(slot);
+    } else {
+        process_due();
+    }
 }
 
 void main_loop() {
 	maint();
-	usleep(0);
+    stats_tick();
+    // Let user processes run, in-process users don't need it
+    if (engine == E_FORK || engine == E_POOL)
+        usleep(0);
 }
 
-int main(int argc, char *argv[]) {
+/* Feeds what users did in the replayed trace to the allocator, as fast as it goes.
+ * Everything else in the trace is what oss did about it, which the replay
+ * does again by itself. Returns the number of events fed.
+ */
+ulong replay_run()
+{
+    ulong fed = 0, skipped = 0;
 
-	init();
+    for (ulong i = 0; i < replay_count && running; i++) {
+        trace_event *e = &replay_events[i];
 
-    if (!strcmp(argv[1], "-v"))
-        verbose = true;
+        clock_set(e->time);
+        switch (e->type) {
+        case TR_RESOURCE:
+            res_info[e->res_id].shared = e->pid;
+            res_info[e->res_id].limit = e->arg;
+            trace(TR_RESOURCE, e->pid, e->res_id, e->arg);
+            break;
+        case TR_SPAWN:
+            if (taken[e->pid] != 0) {
+                skipped++;
+                break;
+            }
+            spawn_process(e->pid);
+            fed++;
+            break;
+        case TR_CLAIM:
+            claim_column(e->res_id)[e->pid] = e->arg;
+            trace(TR_CLAIM, e->pid, e->res_id, e->arg);
+            pcbs[e->pid].claims_known = true;
+            break;
+        case TR_REQUEST:
+            if (pcb_state(e->pid) != S_ACTIVE) {
+                skipped++;
+                break;
+            }
+            resource_requested(e->pid, e->res_id);
+            fed++;
+            break;
+        case TR_RELEASE:
+            if (pcb_state(e->pid) != S_ACTIVE || units_held(e->res_id, e->pid) == 0) {
+                skipped++;
+                break;
+            }
+            resource_released(e->pid, e->res_id);
+            fed++;
+            break;
+        case TR_REQUEST_MANY:
+        case TR_RELEASE_MANY: {
+            // The items are the events right after
+            res_amount items[MSG_MAX_ITEMS];
+            int n = 0;
+            bool possible = pcb_state(e->pid) == S_ACTIVE;
+            while (n < e->arg && n < MSG_MAX_ITEMS && i + 1 < replay_count) {
+                trace_event *item = &replay_events[++i];
+                items[n].res_id = item->res_id;
+                items[n].units = item->arg;
+                if (e->type == TR_RELEASE_MANY && units_held(item->res_id, e->pid) < item->arg)
+                    possible = false;
+                n++;
+            }
+            if (!possible) {
+                skipped++;
+                break;
+            }
+            if (e->type == TR_REQUEST_MANY)
+                resources_requested(e->pid, items, n);
+            else
+                resources_released(e->pid, items, n);
+            fed++;
+            break;
+        }
+        case TR_TERMINATE:
+            if (pcb_state(e->pid) != S_ACTIVE) {
+                skipped++;
+                break;
+            }
+            process_terminated(e->pid);
+            fed++;
+            break;
+        default:
+            break;
+        }
+    }
+    if (skipped)
+        forcelogprintf("Replay skipped %lu events the replayed processes couldn't have done", skipped);
+    return fed;
+}
 
-    spawn_process(0);
-    schedule_proc_spawn();
+/* Compares the events of the replay with the recorded ones, times aside */
+void replay_check()
+{
+    ulong n = min(trace_count, replay_count);
+    ulong i = 0;
 
-	/* main loop */
-    while(running) {
-		main_loop();
-	}
+    while (i < n && replay_events[i].type == trace_events[i].type && replay_events[i].pid == trace_events[i].pid
+            && replay_events[i].res_id == trace_events[i].res_id && replay_events[i].arg == trace_events[i].arg)
+        i++;
+
+    if (i == replay_count && i == trace_count) {
+        forcelogprintf("Replay reproduced all %lu events of the trace", replay_count);
+        printf("Replay reproduced all %lu events of the trace\n", replay_count);
+        return;
+    }
+    forcelogprintf("Replay diverged from the trace at event %lu of %lu", i, replay_count);
+    printf("Replay diverged from the trace at event %lu of %lu\n", i, replay_count);
+}
+
+void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-v] [-a] [-d] [-g] [-k held|youngest|units] [-w fifo|priority] [-t msgq|shm] [-l] [-q]\n", prog);
+    fprintf(stderr, "       [-e fork|pool|inproc] [-p pcbs] [-r resources] [-L debug|verbose|summary]\n");
+    fprintf(stderr, "       [-b drop|block|sample] [-T trace] [-R trace] [-S stats.csv] [-M stats.prom]\n");
+    fprintf(stderr, "       [-s seed] [-m managers] [-H] [-P]\n");
+    fprintf(stderr, "  -v  verbose log, same as -L verbose\n");
+    fprintf(stderr, "  -L  lowest level logged: debug (user processes too), verbose\n");
+    fprintf(stderr, "      or summary (default)\n");
+    fprintf(stderr, "  -b  when the log can't keep up: drop lines, block (default)\n");
+    fprintf(stderr, "      or keep a sample of them\n");
+    fprintf(stderr, "  -T  record a binary trace of events to a file, see tracedump\n");
+    fprintf(stderr, "  -R  replay what users did in a trace without running any users\n");
+    fprintf(stderr, "  -S  append statistics to a CSV file every half second of real time\n");
+    fprintf(stderr, "  -M  keep the latest statistics in an OpenMetrics text file\n");
+    fprintf(stderr, "  -s  seed random numbers, runs with -e inproc and the same seed are identical\n");
+    fprintf(stderr, "  -a  avoid deadlocks with the banker's algorithm\n");
+    fprintf(stderr, "  -d  look for deadlocks on a thread of its own, not with -T or -R\n");
+    fprintf(stderr, "  -k  deadlock victim policy: fewest held resources, youngest process\n");
+    fprintf(stderr, "      or fewest held units (default)\n");
+    fprintf(stderr, "  -w  order of waking up blocked processes: first come first served (default)\n");
+    fprintf(stderr, "      or processes holding the most units first\n");
+    fprintf(stderr, "  -t  message transport: System V message queues (default)\n");
+    fprintf(stderr, "      or rings in shared memory\n");
+    fprintf(stderr, "  -l  run processes one at a time instead of all at once\n");
+    fprintf(stderr, "  -q  run processes one at a time, picked by multi-level feedback queues\n");
+    fprintf(stderr, "      with real-time and normal classes\n");
+    fprintf(stderr, "  -g  users ask for several units of several resources in one message,\n");
+    fprintf(stderr, "      granted all or nothing, and give back several in one message\n");
+    fprintf(stderr, "  -m  split resources among this many threads deciding requests concurrently,\n");
+    fprintf(stderr, "      not with -a, -g, -T or -R\n");
+    fprintf(stderr, "  -e  run users as forked ./user processes (default), as ./user workers\n");
+    fprintf(stderr, "      forked once for every PCB and reset for each new user, or inside oss\n");
+    fprintf(stderr, "  -H  back the shared memory with huge pages, reserved ones if there are enough\n");
+    fprintf(stderr, "  -P  fault in all of the shared memory in every process up front\n");
+    fprintf(stderr, "  -p  number of PCBs (default %d)\n", DEFAULT_PCB_NUM);
+    fprintf(stderr, "  -r  number of resources (default %d)\n", DEFAULT_RESOURCE_NUM);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "vadgk:w:t:lqm:e:p:r:L:b:T:R:S:M:s:HP")) != -1) {
+        switch (opt) {
+        case 'v':
+            log_min_level = min(log_min_level, L_VERBOSE);
+            break;
+        case 'a':
+            avoidance = true;
+            break;
+        case 'g':
+            batch_requests = true;
+            break;
+        case 'k':
+            victim_cost = NULL;
+            for (int i = 0; victim_policies[i].name; i++)
+                if (!strcmp(optarg, victim_policies[i].name))
+                    victim_cost = victim_policies[i].cost;
+            if (victim_cost == NULL)
+                usage(argv[0]);
+            break;
+        case 'w':
+            if (!strcmp(optarg, "fifo"))
+                priority_wakeup = false;
+            else if (!strcmp(optarg, "priority"))
+                priority_wakeup = true;
+            else
+                usage(argv[0]);
+            break;
+        case 'e':
+            if (!strcmp(optarg, "fork"))
+                engine = E_FORK;
+            else if (!strcmp(optarg, "pool"))
+                engine = E_POOL;
+            else if (!strcmp(optarg, "inproc"))
+                engine = E_INPROC;
+            else
+                usage(argv[0]);
+            break;
+        case 'l':
+            lockstep = true;
+            break;
+        case 'q':
+            mlfq_scheduling = true;
+            break;
+        case 'd':
+            background_detection = true;
+            break;
+        case 'm':
+            manager_threads = atoi(optarg);
+            if (manager_threads < 1)
+                usage(argv[0]);
+            break;
+        case 'L':
+            if (!strcmp(optarg, "debug"))
+                log_min_level = L_DEBUG;
+            else if (!strcmp(optarg, "verbose"))
+                log_min_level = L_VERBOSE;
+            else if (!strcmp(optarg, "summary"))
+                log_min_level = L_SUMMARY;
+            else
+                usage(argv[0]);
+            break;
+        case 'b':
+            if (!strcmp(optarg, "drop"))
+                log_backpressure = LP_DROP;
+            else if (!strcmp(optarg, "block"))
+                log_backpressure = LP_BLOCK;
+            else if (!strcmp(optarg, "sample"))
+                log_backpressure = LP_SAMPLE;
+            else
+                usage(argv[0]);
+            break;
+        case 'T':
+            trace_path = optarg;
+            break;
+        case 'S':
+            stats_csv_path = optarg;
+            break;
+        case 'M':
+            stats_om_path = optarg;
+            break;
+        case 'R':
+            replay_path = optarg;
+            engine = E_REPLAY;
+            break;
+        case 'H':
+            huge_pages = true;
+            break;
+        case 'P':
+            prefault_segment = true;
+            break;
+        case 's':
+            seed = atol(optarg);
+            if (seed < 0)
+                usage(argv[0]);
+            break;
+        case 'p':
+            pcb_num = atoi(optarg);
+            if (pcb_num < 1)
+                usage(argv[0]);
+            break;
+        case 'r':
+            resource_num = atoi(optarg);
+            if (resource_num < 1)
+                usage(argv[0]);
+            break;
+        case 't':
+            if (!strcmp(optarg, "msgq"))
+                transport = T_MSGQ;
+            else if (!strcmp(optarg, "shm"))
+                transport = T_SHM;
+            else
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    // The banker and all-or-nothing requests look at several resources at once, a manager only at its own
+    if (manager_threads && (avoidance || batch_requests))
+        usage(argv[0]);
+    // A trace has one order of events, with other threads deciding it changes from run to run
+    if ((manager_threads || background_detection) && (trace_path || engine == E_REPLAY))
+        usage(argv[0]);
+
+    init();
+
+    if (engine == E_REPLAY) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ulong fed = replay_run();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        long ns = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+        forcelogprintf("Replayed %lu user events in %ld ns, %ld ns per event", fed, ns, fed ? ns / fed : 0);
+    } else {
+        spawn_process(0);
+        schedule_proc_spawn();
+
+        /* main loop */
+        while(running) {
+            main_loop();
+        }
+    }
 	printf("Terminating oss\n");
     forcelogprintf("Terminating oss=========================================");
     forcelogprintf("Granted %d resources", requests_granted);
+    forcelogprintf("Request messages: %ld, %.2f units granted per request, release messages: %ld", request_msgs,
+            request_msgs ? (double)requests_granted / request_msgs : 0, release_msgs);
+    forcelogprintf("Processes spawned: %d, %ld ns per spawn", spawns, spawns ? spawn_ns / spawns : 0);
     forcelogprintf("Processes terminated normally: %d", terminated_procs);
     forcelogprintf("Processes killed by deadlock recovery: %d", killed_procs);
-    forcelogprintf("Deadlock recoveries run: %d", dedeadlocks_run);
-    forcelogprintf("Closing log at time %d:%d", shm->cpu_clock.sec, shm->cpu_clock.usec);
+    if (avoidance) {
+        forcelogprintf("Requests granted by safety check: %d", safe_grants);
+        forcelogprintf("Requests denied by safety check: %d", unsafe_denials);
+        forcelogprintf("Safety checks run: %d, total %ld ns, %ld ns per check", banker_checks,
+                banker_check_ns, banker_checks ? banker_check_ns / banker_checks : 0);
+    }
+    forcelogprintf("Deadlock detections run: %d, total %ld ns searching, %ld ns per detection", dedeadlocks_run,
+            dedeadlock_ns, dedeadlocks_run ? dedeadlock_ns / dedeadlocks_run : 0);
+    forcelogprintf("Grant latency: p50 %lu, p99 %lu, max %lu ns simulated, p50 %lu, p99 %lu ns wall clock",
+            stats_quantile(H_GRANT_SIM, 0.5), stats_quantile(H_GRANT_SIM, 0.99), shm_stats->hist[H_GRANT_SIM].max,
+            stats_quantile(H_GRANT_WALL, 0.5), stats_quantile(H_GRANT_WALL, 0.99));
+    forcelogprintf("Time blocked: p50 %lu, p99 %lu, max %lu ns simulated", stats_quantile(H_BLOCKED, 0.5),
+            stats_quantile(H_BLOCKED, 0.99), shm_stats->hist[H_BLOCKED].max);
+    if (background_detection)
+        forcelogprintf("Detection snapshots taken: %d, %ld ns per snapshot, %d deadlocked sets gone when checked",
+                snapshots, snapshots ? snapshot_ns / snapshots : 0, stale_sets);
+    if (mlfq_scheduling)
+        forcelogprintf("Feedback queue turns by level: %ld %ld %ld %ld, %d demotions, %d promotions, %d boosts",
+                mlfq_turns[0], mlfq_turns[1], mlfq_turns[2], mlfq_turns[3], mlfq_demotions, mlfq_promotions,
+                mlfq_boosts);
+    if (manager_threads)
+        forcelogprintf("Manager threads: %d, %ld requests and releases routed, %d syncs, %ld ns per sync",
+                manager_threads, partition_ops, partition_syncs,
+                partition_syncs ? partition_sync_ns / partition_syncs : 0);
+    forcelogprintf("Closing log at time " OSSTIME_FMT, OSSTIME_ARGS(clock_now()));
 
 	uninit();
 
@@ -435,10 +976,12 @@ void signalHandler(int sig) {
 		case SIGTERM:
 			printf("handling SIGINT/SIGTERM signal\n");
             running = false;
+            channel_interrupt();
 			break;
 		case SIGALRM:
 			printf("handling SIGALRM signal\n");
             running = false;
+            channel_interrupt();
 			break;
 
 		default:
@@ -448,7 +991,7 @@ void signalHandler(int sig) {
 
 /* Finds a free PID for new process or -1 if no PID available */
 int find_free_pid() {
-	for (int i = 0; i < PCB_NUM; ++i) {
+	for (int i = 0; i < pcb_num; ++i) {
 		if (taken[i] == 0) {
 			return i;
 		}
@@ -456,93 +999,139 @@ int find_free_pid() {
 	return -1;
 }
 
+/* Sets up the PCB of a process that has just been spawned */
+void start_pcb(int pid_to_spawn, int taken_by)
+{
+    taken[pid_to_spawn] = taken_by;
+    resmgr_start(pid_to_spawn);
+    // One process in NORMAL_PROCS + 1 is real-time
+    if (mlfq_scheduling)
+        mlfq_start(pid_to_spawn, spawns % (NORMAL_PROCS + 1) == 0);
+    // Its first turn is right away, its reply tells when it wants the next one
+    next_action[pid_to_spawn] = clock_now();
+    schedule_user(pid_to_spawn);
+}
+
+/* Forks and execs ./user for a PCB, seed is its argument after the PCB number */
+pid_t fork_user(int pid_to_spawn, const char *seed_arg)
+{
+    pid_t parent = getpid();
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        // A user gets SIGUSR1 when oss dies, like when it ends normally, even if oss crashed
+        prctl(PR_SET_PDEATHSIG, SIGUSR1);
+        if (getppid() != parent)
+            exit(1);
+		/* Run user process */
+		char pid_str[16];
+		sprintf(pid_str, "%d", pid_to_spawn);
+		execl("./user", "./user", pid_str, seed_arg, (char*)NULL);
+		perror("execl: ");
+		exit(1);
+    }
+    EXIT_ON_ERROR(pid, "fork");
+    return pid;
+}
+
+/* Pool engine: forks a worker for every PCB, with its channel, once for the whole run */
+void start_workers()
+{
+    workers = calloc(pcb_num, sizeof(pid_t));
+    for (int i = 0; i < pcb_num; i++) {
+        channel_open(i);
+        workers[i] = fork_user(i, "pool");
+    }
+}
+
+/* Pool engine: tells the workers to exit and removes their channels */
+void stop_workers()
+{
+    for (int i = 0; i < pcb_num; i++)
+        kill(workers[i], SIGUSR1);
+    for (int i = 0; i < pcb_num; i++) {
+        waitpid(workers[i], NULL, 0);
+        channel_close(i);
+    }
+}
+
 /* Spawns a new user process */
 void spawn_process(int pid_to_spawn) {
-	pid_t pid;
-	int i = 0;
+    struct timespec start, end;
+    // Users get their random seeds from oss, so a run with -s is the same every time
+    uint user_seed = rand();
 
 	/* Do nothing if children limit reached */
 	if (count_children() >= childrenLimit)
 		return;
 
     logprintf(true, "Spawning a new Process P%d", pid_to_spawn);
+    trace(TR_SPAWN, pid_to_spawn, -1, 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    switch (engine) {
+    case E_FORK: {
+        char seed_str[16];
+        sprintf(seed_str, "%u", user_seed);
+        channel_open(pid_to_spawn);
+        start_pcb(pid_to_spawn, fork_user(pid_to_spawn, seed_str));
+        break;
+    }
+    case E_POOL: {
+        // The worker starts over as a new user, its old PCB has been cleaned up already
+        ipc_message msg;
+        msg._msgtyp = 0;
+        msg.type = RESET;
+        msg.seed = user_seed;
+        start_pcb(pid_to_spawn, workers[pid_to_spawn]);
+        send_to_user(pid_to_spawn, &msg);
+        break;
+    }
+    case E_INPROC:
+        start_pcb(pid_to_spawn, INPROC_TAKEN);
+        behaviour_init(&users[pid_to_spawn], pid_to_spawn, user_seed);
+        claims_declared(pid_to_spawn);
+        break;
+    default:
+        start_pcb(pid_to_spawn, INPROC_TAKEN);
+        break;
+    }
 
-	/* Fork a process */
-	pid = fork();
-	if (pid) {
-		/* Create structures for keeping its data in master process */
-		taken[pid_to_spawn] = pid;
-		pcb *pcb = &shm->pcbs[pid_to_spawn];
-		pcb->pid = pid_to_spawn;
-		pcb->state = S_ACTIVE;
-        pcb->blocked_on = -1;
-
-		key_t k1 = KEY_PREFIX + 2*pid+1;
-		key_t k2 = KEY_PREFIX + 2*pid+2;
-
-		pcb->msq_to_user = msgget(k1, IPC_CREAT | PERMS);
-		pcb->msq_to_oss = msgget(k2, IPC_CREAT | PERMS);
-		EXIT_ON_ERROR(pcb->msq_to_user, "msgget");
-		EXIT_ON_ERROR(pcb->msq_to_oss, "msgget");
-	} else {
-		/* Run user process */
-		char *pid_str = malloc(4 * sizeof(char));
-		sprintf(pid_str, "%d", pid_to_spawn);
-		execl("./user", "./user", pid_str, (char*)NULL);
-		perror("execl: ");
-		exit(1);
-	}
-}
-
-int msqrm(int msqid) {
-    if (-1 == msgctl(msqid, IPC_RMID, NULL))
-        perror("msgrm");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    spawns++;
+    spawn_ns += (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
 }
 
 /* Delete a user process's data structures */
 void cleanup_process(int pid) {
-	pcb *pcb = &shm->pcbs[pid];
-    char released[1024], resstr[128];
-    released[0] = 0;
-    resstr[0] = 0;
-
     logprintf(true, "Terminating process p%d", pid);
 
-	msqrm(pcb->msq_to_oss);
-	msqrm(pcb->msq_to_user);
-
-    waitpid(taken[pid], NULL, 0);
+    if (engine == E_FORK) {
+        channel_close(pid);
+        waitpid(taken[pid], NULL, 0);
+    }
     taken[pid] = 0;
-
-    for (int i = 0; i < RESOURCE_NUM; i++)
-        if (shm->resources[i].allocated[pid] > 0) {
-            sprintf(resstr, " R%d:%d", i, shm->resources[i].allocated[pid]);
-            strcat(released, resstr);
-        }
-    logprintf(false, "Released resources: %s", released);
-    for (int i = 0; i < RESOURCE_NUM; i++)
-        if (shm->resources[i].allocated[pid] > 0) {
-            shm->resources[i].allocated[pid] = 0;
-            wake_up_on_resource(i);
-        }
-
-    memset(pcb, 0, sizeof(pcb));
-    pcb->blocked_on = -1;
+    eventq_cancel(pid);
+    if (mlfq_scheduling)
+        mlfq_cancel(pid);
+    if (engine == E_INPROC)
+        behaviour_free(&users[pid]);
+    resmgr_release_all(pid);
 }
 
 /* Kill all processes with SIGUSR1 */
 void cleanup_processes() {
 	int i;
-	for (i = 0; i < PCB_NUM; i++) {
-		pcb *pcb = &shm->pcbs[i];
-		msqrm(pcb->msq_to_oss);
-		msqrm(pcb->msq_to_user);
-
+	for (i = 0; i < pcb_num; i++) {
 		if (taken[i] == 0)
 			continue;
-		printf("kill %d\n", taken[i]);
-		kill(taken[i], SIGUSR1);
+        if (engine == E_FORK) {
+            printf("kill %d\n", taken[i]);
+            kill(taken[i], SIGUSR1);
+        }
 		cleanup_process(i);
 	}
+    if (engine == E_POOL)
+        stop_workers();
 }
 
@@ -3,16 +3,62 @@
 
 #include "types.h"
 
-typedef struct {
-	ulong sec;
-	ulong usec;
-} osstime;
-
-void osstime_add(osstime *left, osstime *right);
-void osstime_advance(osstime *left, uint usec);
-void osstime_sub(osstime *left, osstime *right);
-void osstime_mul(osstime *left, double right);
-int osstime_cmp(osstime *left, osstime *right);
-osstime *make_osstime(ulong sec, ulong usec);
+/* Simulated time in nanoseconds since oss started, a single 64-bit word.
+ * That lasts for 584 years and every operation is a plain integer
+ * instruction, without the carries and divisions of a sec/usec pair.
+ * Seconds are only split off for printing.
+ */
+
+typedef ulong osstime;
+
+#define OSSTIME_TICKS_PER_SEC 1000000000UL
+
+static inline osstime osstime_add(osstime left, osstime right) {
+    return left + right;
+}
+
+/* Difference of left and right, 0 if right is later */
+static inline osstime osstime_sub(osstime left, osstime right) {
+    osstime diff = left - right;
+    return diff & -(osstime)(left >= right);
+}
+
+static inline void osstime_advance(osstime *left, ulong ticks) {
+    *left += ticks;
+}
+
+/* Compares two times. Returns
+ * -1 if right is later, 1 if left is later and 0 if they're equal
+ */
+static inline int osstime_cmp(osstime left, osstime right) {
+    return (left > right) - (left < right);
+}
+
+static inline osstime osstime_min(osstime left, osstime right) {
+    return left < right ? left : right;
+}
+
+static inline osstime osstime_max(osstime left, osstime right) {
+    return left > right ? left : right;
+}
+
+/* Scale factors are fixed-point numbers with 32 fraction bits */
+typedef ulong osstime_factor;
+
+#define OSSTIME_FACTOR_ONE (1UL << 32)
+
+/* Factor num/den, the only division is here, when a factor is made */
+static inline osstime_factor osstime_factor_of(uint num, uint den) {
+    return ((ulong)num << 32) / den;
+}
+
+/* Multiplies time by a factor, rounding down */
+static inline osstime osstime_scale(osstime t, osstime_factor f) {
+    return (osstime)(((unsigned __int128)t * f) >> 32);
+}
+
+/* Printing: printf(OSSTIME_FMT, OSSTIME_ARGS(t)) shows seconds with 9 decimals */
+#define OSSTIME_FMT "%lu.%09lu"
+#define OSSTIME_ARGS(t) (ulong)((t) / OSSTIME_TICKS_PER_SEC), (ulong)((t) % OSSTIME_TICKS_PER_SEC)
 
 #endif
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "partition.h"
+#include "resmgr.h"
+
+/* This module implements the manager threads of the -m mode.
+ *
+ * Every manager owns the resources r with r % partitions equal to its index,
+ * along with their wait queues, and is the only thread that calls
+ * resource_requested() and resource_released() on them. Its operations come
+ * through a bounded multi-producer ring built like the log's (see log.c):
+ * producers claim a slot with a compare and swap on tail and publish it by
+ * storing the slot's sequence number. A manager that finds its ring empty
+ * parks on a futex on the sequence number of the slot it waits for.
+ *
+ * A pid has at most one operation in flight, so the PCB data of the
+ * requester is only ever touched by one thread at a time. Managers never
+ * look for deadlocks: a cycle can run through resources of several managers
+ * and none of them sees it whole. They note the processes they blocked and
+ * granted units to, and partition_sync() hands those to oss once every
+ * manager has finished everything routed to it and nothing changes anymore.
+ */
+
+#define OP_SLOTS 4096
+
+typedef enum { OP_REQUEST, OP_RELEASE, OP_SYNC, OP_STOP } op_type;
+
+typedef struct {
+    // Position the slot is free for, or position + 1 once its operation is published
+    uint seq;
+    op_type type;
+    uint pid;
+    int res_id;
+} op_slot;
+
+typedef struct {
+    op_slot *slots;
+    // Producers and the manager write these, each on its own cache line
+    uint tail __attribute__((aligned(CACHE_LINE)));
+    uint head __attribute__((aligned(CACHE_LINE)));
+    uint waiting;
+    uint seed;
+    pthread_t thread;
+    // Processes blocked and granted units since the last partition_sync()
+    int *blocked;
+    int nblocked;
+    int *granted;
+    int ngranted;
+} partition;
+
+int partitions = 0;
+static partition *parts;
+// Managers still to reach the barrier of partition_sync()
+static uint pending;
+static __thread partition *self;
+
+/* statistics */
+long partition_ops = 0;
+long partition_sync_ns = 0;
+int partition_syncs = 0;
+
+static int futex(uint *addr, int op, uint val) {
+    return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+static void push(partition *p, op_type type, uint pid, int res_id) {
+    uint pos = __atomic_load_n(&p->tail, __ATOMIC_RELAXED);
+    op_slot *slot;
+
+    for (;;) {
+        slot = &p->slots[pos % OP_SLOTS];
+        int diff = (int)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&p->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            // The ring is full, the manager is behind
+            sched_yield();
+            pos = __atomic_load_n(&p->tail, __ATOMIC_RELAXED);
+        } else {
+            // Another producer took it
+            pos = __atomic_load_n(&p->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->type = type;
+    slot->pid = pid;
+    slot->res_id = res_id;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    // Pairs with the fence in take(), either we see it parked or it sees the slot published
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&p->waiting, __ATOMIC_RELAXED))
+        futex(&slot->seq, FUTEX_WAKE_PRIVATE, 1);
+}
+
+/* Waits for the next operation of the manager's ring */
+static op_slot take(partition *p) {
+    op_slot *slot = &p->slots[p->head % OP_SLOTS];
+    op_slot op;
+
+    while (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != p->head + 1) {
+        __atomic_store_n(&p->waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == p->head)
+            futex(&slot->seq, FUTEX_WAIT_PRIVATE, p->head);
+        __atomic_store_n(&p->waiting, 0, __ATOMIC_RELAXED);
+    }
+
+    op = *slot;
+    // Free the slot for the producer that comes around the ring next time
+    __atomic_store_n(&slot->seq, p->head + OP_SLOTS, __ATOMIC_RELEASE);
+    p->head++;
+    return op;
+}
+
+static void *manager_main(void *arg) {
+    self = arg;
+
+    for (;;) {
+        op_slot op = take(self);
+        switch (op.type) {
+        case OP_REQUEST:
+            resource_requested(op.pid, op.res_id);
+            break;
+        case OP_RELEASE:
+            resource_released(op.pid, op.res_id);
+            break;
+        case OP_SYNC:
+            // The release orders everything this manager did before oss reads it
+            if (__atomic_sub_fetch(&pending, 1, __ATOMIC_ACQ_REL) == 0)
+                futex(&pending, FUTEX_WAKE_PRIVATE, 1);
+            break;
+        case OP_STOP:
+            return NULL;
+        }
+    }
+}
+
+/* Starts n managers for the resources in shm */
+void partition_start(int n) {
+    sigset_t all, old;
+
+    // Signals are for the main thread, the managers inherit a mask blocking them
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    partitions = n;
+    parts = calloc(n, sizeof(partition));
+    for (int i = 0; i < n; i++) {
+        partition *p = &parts[i];
+        p->slots = malloc(OP_SLOTS * sizeof(op_slot));
+        for (uint j = 0; j < OP_SLOTS; j++)
+            p->slots[j].seq = j;
+        p->seed = rand();
+        p->blocked = malloc(pcb_num * sizeof(int));
+        p->granted = malloc(pcb_num * sizeof(int));
+        if (pthread_create(&p->thread, NULL, manager_main, p)) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* Stops the managers once they have done everything routed to them */
+void partition_stop() {
+    for (int i = 0; i < partitions; i++)
+        push(&parts[i], OP_STOP, 0, -1);
+    for (int i = 0; i < partitions; i++) {
+        pthread_join(parts[i].thread, NULL);
+        free(parts[i].slots);
+        free(parts[i].blocked);
+        free(parts[i].granted);
+    }
+    free(parts);
+    partitions = 0;
+}
+
+void partition_request(uint pid, int res_id) {
+    partition_ops++;
+    push(&parts[res_id % partitions], OP_REQUEST, pid, res_id);
+}
+
+void partition_release(uint pid, int res_id) {
+    partition_ops++;
+    push(&parts[res_id % partitions], OP_RELEASE, pid, res_id);
+}
+
+/* Waits until every manager has done everything routed to it so far, after
+ * that oss sees a consistent state that doesn't change until it routes more.
+ * Fills blocked and granted, both pcb_num long, with the processes managers
+ * blocked and granted units to in the meantime, in manager order.
+ */
+void partition_sync(int *blocked, int *nblocked, int *granted, int *ngranted) {
+    struct timespec start, end;
+    uint left;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    __atomic_store_n(&pending, partitions, __ATOMIC_RELAXED);
+    for (int i = 0; i < partitions; i++)
+        push(&parts[i], OP_SYNC, 0, -1);
+    while ((left = __atomic_load_n(&pending, __ATOMIC_ACQUIRE)) != 0)
+        futex(&pending, FUTEX_WAIT_PRIVATE, left);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    partition_syncs++;
+    partition_sync_ns += (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+
+    // With one operation in flight a process is blocked at most once and granted at most once in between
+    *nblocked = *ngranted = 0;
+    for (int i = 0; i < partitions; i++) {
+        partition *p = &parts[i];
+        for (int j = 0; j < p->nblocked; j++)
+            blocked[(*nblocked)++] = p->blocked[j];
+        for (int j = 0; j < p->ngranted; j++)
+            granted[(*ngranted)++] = p->granted[j];
+        p->nblocked = p->ngranted = 0;
+    }
+}
+
+/* Tells if the caller is a manager thread */
+bool partition_thread() {
+    return self != NULL;
+}
+
+/* Random state of the calling manager, rand() is shared by all threads, or NULL on other threads */
+uint *partition_seed() {
+    return self ? &self->seed : NULL;
+}
+
+/* Called on a manager thread when it blocks pid, oss looks for deadlocks after the next sync */
+void partition_blocked(uint pid) {
+    self->blocked[self->nblocked++] = pid;
+}
+
+/* Called on a manager thread when it grants pid a unit, oss schedules its turns after the next sync */
+void partition_granted(uint pid) {
+    self->granted[self->ngranted++] = pid;
+}
@@ -0,0 +1,36 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <stdbool.h>
+
+#include "common.h"
+
+/* Manager threads for the -m mode of oss. Resource r belongs to manager
+ * r % partitions, which makes every allocation decision about it.
+ * oss routes requests and releases to the managers and waits for them to
+ * catch up with partition_sync() before doing anything that looks at more
+ * than one resource, like deadlock detection.
+ */
+
+/* Number of manager threads, 0 if oss does everything on its main thread */
+extern int partitions;
+
+void partition_start(int n);
+void partition_stop();
+
+void partition_request(uint pid, int res_id);
+void partition_release(uint pid, int res_id);
+void partition_sync(int *blocked, int *nblocked, int *granted, int *ngranted);
+
+/* For code that runs on manager threads too */
+bool partition_thread();
+uint *partition_seed();
+void partition_blocked(uint pid);
+void partition_granted(uint pid);
+
+/* Operations routed to managers, and barriers waited for and the time spent in them */
+extern long partition_ops;
+extern long partition_sync_ns;
+extern int partition_syncs;
+
+#endif
@@ -0,0 +1,685 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "resmgr.h"
+#include "osstime.h"
+#include "waitgraph.h"
+#include "banker.h"
+#include "waitq.h"
+#include "log.h"
+#include "trace.h"
+#include "partition.h"
+#include "detector.h"
+
+/* This module is the part of oss that decides who gets which resource.
+ * oss and the benchmark both drive it through resource_requested(),
+ * resource_released() and resmgr_release_all(), and tell it about new
+ * processes with resmgr_start(). Grants are reported with send_to_user()
+ * and deadlock victims handed to kill_process(), which the program
+ * linking the module provides.
+ *
+ * With manager threads (partition.c) requests and releases of different
+ * resources run concurrently. Blocking then leaves deadlock detection to oss,
+ * which runs it once the managers are done, and the statistics are counted
+ * atomically.
+ *
+ * An all-or-nothing request for several resources (resources_requested())
+ * is kept until it can be granted whole. Meanwhile its process waits in the
+ * queue of one resource it can't have: when that one frees up and another
+ * still can't be had, the process moves to the other one's queue, which is
+ * a new block as far as the wait-for graph is concerned.
+ *
+ * With background detection (detector.c) blocking only marks the graph as
+ * changed. resmgr_poll() hands the detector a snapshot of the graph and
+ * recovers from the deadlocks it finds once they are confirmed live.
+ */
+
+bool avoidance = false;
+bool priority_wakeup = false;
+bool background_detection = false;
+victim_cost_fn victim_cost = cost_held_units;
+
+/* Order in which processes were spawned, used by victim selection */
+static ulong *spawn_seq;
+static ulong spawned = 0;
+
+/* All-or-nothing requests waiting to be granted, nwanted[pid] is 0 if pid's isn't one */
+static res_amount (*wanted)[MSG_MAX_ITEMS];
+static int *nwanted;
+/* Avoidance mode: whether each queue's head was refused by the banker or
+ * the queue is to be served once a release has given everything back */
+enum { Q_SERVED, Q_REFUSED, Q_RELEASED };
+static uchar *recheck;
+
+/* Processes got blocked since the detector's last snapshot */
+static bool graph_changed = false;
+
+/* statistics */
+int requests_granted = 0;
+int dedeadlocks_run = 0;
+long dedeadlock_ns = 0;
+int safe_grants = 0;
+int unsafe_denials = 0;
+int snapshots = 0;
+long snapshot_ns = 0;
+int stale_sets = 0;
+
+/* Sets up the core for the PCBs and resources in shm */
+void resmgr_init()
+{
+    for (int i = 0; i < pcb_num; i++) {
+        pcbs[i].blocked_on = -1;
+        pcbs[i].wq_prev = pcbs[i].wq_next = -1;
+        pcbs[i].held_head = -1;
+    }
+    for (int i = 0; i < resource_num; i++)
+        waitq_init(&resources[i].queue);
+    stats_init();
+
+    free(spawn_seq);
+    spawn_seq = calloc(pcb_num, sizeof(ulong));
+    spawned = 0;
+    free(wanted);
+    free(nwanted);
+    wanted = calloc(pcb_num, sizeof(*wanted));
+    nwanted = calloc(pcb_num, sizeof(int));
+    free(recheck);
+    recheck = calloc(resource_num, 1);
+    wfg_init();
+    if (avoidance)
+        banker_init();
+    graph_changed = false;
+    detector_stop();
+    if (background_detection)
+        detector_start();
+}
+
+/* Stops what resmgr_init() started */
+void resmgr_shutdown()
+{
+    detector_stop();
+}
+
+/* Sets up the PCB of a process that has just been spawned */
+void resmgr_start(int pid)
+{
+    spawn_seq[pid] = spawned++;
+    pcb *pcb = &pcbs[pid];
+    pcb->pid = pid;
+    pcb->blocked_on = -1;
+    pcb->claims_known = false;
+    nwanted[pid] = 0;
+    pcb_set_state(pid, S_ACTIVE);
+}
+
+/* oss spends between min and max ticks of simulated time on something.
+ * Manager threads draw from their own random state, rand() is shared. */
+static void spend(int min, int max)
+{
+    uint *seed = partition_seed();
+    clock_advance(seed ? rand_r(seed) % (max - min + 1) + min : rnd(min, max));
+}
+
+void printres() {
+    char row[8 + 4 * resource_num + 1];
+    int len;
+
+    if (!log_enabled(L_VERBOSE))
+        return;
+
+    // shareable
+    len = sprintf(row, "        ");
+    for (int res = 0; res < resource_num; res++)
+        len += sprintf(row + len, res_info[res].shared ? "s   " : "ns  ");
+    log_line(L_VERBOSE, "%s", row);
+
+    // Header row
+    len = sprintf(row, "bl      ");
+    for (int res = 0; res < resource_num; res++)
+        len += sprintf(row + len, "R%-3d", res);
+    log_line(L_VERBOSE, "%s", row);
+
+    // Table
+    for (int pid = 0; pid < pcb_num; pid++) {
+        if (pcb_state(pid) == S_BLOCKED)
+            len = sprintf(row, "%-4dP%-3d", pcbs[pid].blocked_on, pid);
+        else
+            len = sprintf(row, "    P%-3d", pid);
+        for (int res = 0; res < resource_num; res++)
+            len += sprintf(row + len, "%-4d", units_held(res, pid));
+        log_line(L_VERBOSE, "%s", row);
+    }
+}
+
+static void block_process(uint pid, int res_id, bool unsafe)
+{
+    logprintf(false, "Blocking process P%d waiting on resource R%d", pid, res_id);
+    trace(TR_BLOCK, pid, res_id, unsafe);
+    pcbs[pid].blocked_on = res_id;
+    pcb_set_state(pid, S_BLOCKED);
+    // In priority mode processes holding more get resources first, so they can finish sooner
+    waitq_push(&resources[res_id].queue, pid, priority_wakeup ? cost_held_units(pid) : 0);
+    if (unsafe)
+        recheck[res_id] = Q_REFUSED;
+    stats_blocked(pid, res_id, resources[res_id].queue.count);
+    wfg_block(pid, res_id);
+    spend(10, 50);
+    // New wait-for edges appeared, that's the only time a deadlock can form
+    if (partition_thread())
+        partition_blocked(pid);
+    else
+        dedeadlock(pid);
+}
+
+static void allocate_resource(uint pid, int res_id)
+{
+    ipc_message msg;
+    msg._msgtyp = 0;
+    units_add(res_id, pid, 1);
+    trace(TR_GRANT, pid, res_id, 0);
+    stats_granted(pid, res_id);
+
+    msg.type = ALLOCATE;
+    msg.res_id = res_id;
+    send_to_user(pid, &msg);
+    spend(1, 10);
+    logprintf(true, "Master granting P%d request R%d", pid, res_id);
+
+    // The table would be torn while other managers change it
+    if (__atomic_add_fetch(&requests_granted, 1, __ATOMIC_RELAXED) % 20 == 0 && !partition_thread())
+        printres();
+}
+
+/* Grants pid its whole all-or-nothing request and tells it with a single message */
+static void allocate_many(uint pid)
+{
+    ipc_message msg;
+    int n = nwanted[pid], units = 0;
+
+    msg._msgtyp = 0;
+    msg.type = ALLOCATE_MANY;
+    msg.nitems = n;
+    for (int i = 0; i < n; i++) {
+        res_amount *item = &wanted[pid][i];
+        units_add(item->res_id, pid, item->units);
+        trace(TR_GRANT, pid, item->res_id, item->units);
+        stats_granted(pid, item->res_id);
+        msg.items[i] = *item;
+        units += item->units;
+    }
+    nwanted[pid] = 0;
+    send_to_user(pid, &msg);
+    spend(1, 10);
+    logprintf(true, "Master granting P%d %d units of %d resources at once", pid, units, n);
+
+    int granted = __atomic_add_fetch(&requests_granted, units, __ATOMIC_RELAXED);
+    if (granted / 20 != (granted - units) / 20)
+        printres();
+}
+
+static void unblock_process(uint pid, int res_id)
+{
+    logprintf(false, "Unblocking Process P%d, and granting it Resource R%d", pid, res_id);
+    trace(TR_UNBLOCK, pid, res_id, 0);
+    stats_unblocked(pid, res_id);
+    pcb_set_state(pid, S_ACTIVE);
+    pcbs[pid].blocked_on = -1;
+    waitq_remove(&resources[res_id].queue, pid);
+    wfg_unblock(pid);
+    spend(1, 50);
+    if (nwanted[pid])
+        allocate_many(pid);
+    else
+        allocate_resource(pid, res_id);
+}
+
+/* Checks if units of res_id can be given to pid right now */
+static bool units_available(uint pid, int res_id, int units)
+{
+    resource *r = &resources[res_id];
+
+    // Non-shared resource
+    if (r->total - units_held(res_id, pid) > 0)
+        return false;
+
+    // Limit reached
+    if (r->total + units > res_info[res_id].limit)
+        return false;
+
+    return true;
+}
+
+/* Checks if a unit of res_id can be given to pid right now */
+bool resource_available(uint pid, int res_id)
+{
+    return units_available(pid, res_id, 1);
+}
+
+/* Units of res_id pid waits for, one unless it's part of an all-or-nothing request */
+static int units_wanted(uint pid, int res_id)
+{
+    for (int i = 0; i < nwanted[pid]; i++)
+        if (wanted[pid][i].res_id == res_id)
+            return wanted[pid][i].units;
+    return 1;
+}
+
+/* Returns a resource of pid's all-or-nothing request it can't have right now or -1 */
+static int first_unavailable(uint pid)
+{
+    for (int i = 0; i < nwanted[pid]; i++)
+        if (!units_available(pid, wanted[pid][i].res_id, wanted[pid][i].units))
+            return wanted[pid][i].res_id;
+    return -1;
+}
+
+/* pid's all-or-nothing request got what it waited for in one queue but not in
+ * another, it waits in that one now */
+static void requeue_process(uint pid, int res_id)
+{
+    int old = pcbs[pid].blocked_on;
+
+    logprintf(false, "Moving process P%d from the queue of R%d to R%d", pid, old, res_id);
+    trace(TR_UNBLOCK, pid, old, 0);
+    stats_unblocked(pid, old);
+    waitq_remove(&resources[old].queue, pid);
+    wfg_unblock(pid);
+    block_process(pid, res_id, false);
+}
+
+void resource_requested(uint pid, int res_id)
+{
+    trace(TR_REQUEST, pid, res_id, 0);
+    stats_requested(pid, res_id);
+    if (!resource_available(pid, res_id)) {
+        block_process(pid, res_id, false);
+        return;
+    }
+
+    // Avoidance mode, only grant if the system stays safe
+    if (avoidance) {
+        if (!banker_safe(pid, res_id)) {
+            logprintf(true, "Master denying P%d request R%d, system would be unsafe", pid, res_id);
+            unsafe_denials++;
+            block_process(pid, res_id, true);
+            return;
+        }
+        safe_grants++;
+    }
+
+    // Everything's fine
+    allocate_resource(pid, res_id);
+}
+
+/* pid asks for all of items at once, units of distinct resources. It gets
+ * them together or none of them while it waits, so it can't get stuck holding
+ * half of what it asked for. It may still hold units it got earlier. */
+void resources_requested(uint pid, const res_amount *items, int n)
+{
+    int res_id;
+
+    trace(TR_REQUEST_MANY, pid, -1, n);
+    for (int i = 0; i < n; i++) {
+        trace(TR_REQUEST, pid, items[i].res_id, items[i].units);
+        stats_requested(pid, items[i].res_id);
+        wanted[pid][i] = items[i];
+    }
+    nwanted[pid] = n;
+
+    if ((res_id = first_unavailable(pid)) != -1) {
+        block_process(pid, res_id, false);
+        return;
+    }
+
+    if (avoidance) {
+        if (!banker_safe_many(pid, items, n)) {
+            logprintf(true, "Master denying P%d request for %d resources, system would be unsafe", pid, n);
+            unsafe_denials++;
+            block_process(pid, items[0].res_id, true);
+            return;
+        }
+        safe_grants++;
+    }
+
+    allocate_many(pid);
+}
+
+/* Returns the only process that can be granted res_id now or -1.
+ * If nobody holds it that's the first in the queue, otherwise the rules in
+ * resource_available() only let the sole holder have more, if it's waiting.
+ */
+static int next_waiter(int res_id)
+{
+    resource *r = &resources[res_id];
+    int holder, cursor = 0;
+
+    if (r->total == 0)
+        return waitq_peek(&r->queue);
+
+    if (r->nholders != 1)
+        return -1;
+    holder = holder_next(res_id, &cursor);
+    return pcb_state(holder) == S_BLOCKED && pcbs[holder].blocked_on == res_id ? holder : -1;
+}
+
+/* Grants res_id to waiting processes in queue order while there are units
+ * left and the banker lets them have it. A refused process stops the queue
+ * like a missing unit does, and the queue is marked so wake_up_safe() knows
+ * someone is waiting for the state to change. */
+static void serve_safe(int res_id)
+{
+    int pid, missing;
+
+    recheck[res_id] = Q_SERVED;
+    while ((pid = next_waiter(res_id)) != -1 && units_available(pid, res_id, units_wanted(pid, res_id))) {
+        if ((missing = first_unavailable(pid)) != -1) {
+            requeue_process(pid, missing);
+        } else if (nwanted[pid] ? banker_safe_many(pid, wanted[pid], nwanted[pid]) : banker_safe(pid, res_id)) {
+            safe_grants++;
+            unblock_process(pid, res_id);
+        } else {
+            recheck[res_id] = Q_REFUSED;
+            return;
+        }
+    }
+}
+
+/* Called in avoidance mode once a release has given everything back. Only the
+ * queues of what it released are served, other queues' heads wait for a
+ * resource whose availability didn't change.
+ * A refused head can still hold back a process behind it that could finish
+ * first, and if every process is waiting that may be the only way on. So
+ * while some queue is refused, waiting processes that can get everything
+ * they still need are granted out of order; that is safe without a check. */
+static void wake_up_safe()
+{
+    bool refused = false;
+
+    if (!avoidance)
+        return;
+    for (int i = 0; i < resource_num; i++) {
+        if (recheck[i] == Q_RELEASED)
+            serve_safe(i);
+        refused |= recheck[i] == Q_REFUSED;
+    }
+    if (!refused)
+        return;
+    for (int pid = 0; pid < pcb_num; pid++) {
+        int res_id = pcbs[pid].blocked_on;
+        if (pcb_state(pid) != S_BLOCKED || !banker_can_finish(pid))
+            continue;
+        if (nwanted[pid] ? first_unavailable(pid) == -1 : resource_available(pid, res_id)) {
+            safe_grants++;
+            unblock_process(pid, res_id);
+        }
+    }
+}
+
+/* Grants res_id to waiting processes in queue order while there are units left,
+ * only the processes actually granted are looked at. A process waiting for an
+ * all-or-nothing request that still misses something moves on to the queue
+ * of what it misses. */
+void wake_up_on_resource(int res_id)
+{
+    int pid, missing;
+
+    // Served by wake_up_safe() once the whole release is back
+    if (avoidance) {
+        recheck[res_id] = Q_RELEASED;
+        return;
+    }
+
+    while ((pid = next_waiter(res_id)) != -1 && units_available(pid, res_id, units_wanted(pid, res_id))) {
+        if ((missing = first_unavailable(pid)) != -1)
+            requeue_process(pid, missing);
+        else
+            unblock_process(pid, res_id);
+    }
+}
+
+void resource_released(uint pid, int res_id)
+{
+    units_add(res_id, pid, -1);
+    trace(TR_RELEASE, pid, res_id, 1);
+    wake_up_on_resource(res_id);
+    wake_up_safe();
+}
+
+/* pid gives back all of items at once, queues are served once everything is back */
+void resources_released(uint pid, const res_amount *items, int n)
+{
+    trace(TR_RELEASE_MANY, pid, -1, n);
+    for (int i = 0; i < n; i++) {
+        units_add(items[i].res_id, pid, -items[i].units);
+        trace(TR_RELEASE, pid, items[i].res_id, items[i].units);
+    }
+    for (int i = 0; i < n; i++)
+        wake_up_on_resource(items[i].res_id);
+    wake_up_safe();
+}
+
+/* Victim cost policies, recovery kills the process with the lowest cost in each deadlocked set */
+
+/* Number of distinct resources held */
+static long cost_held_resources(int pid)
+{
+    long held = 0;
+    int cursor = 0;
+    while (held_next(pid, &cursor) != -1)
+        held++;
+    return held;
+}
+
+/* Youngest process is the cheapest, it has done the least work */
+static long cost_youngest(int pid)
+{
+    return -(long)spawn_seq[pid];
+}
+
+/* Number of resource units that would have to be taken back */
+long cost_held_units(int pid)
+{
+    long units = 0;
+    int cursor = 0, res_id;
+    while ((res_id = held_next(pid, &cursor)) != -1)
+        units += units_held(res_id, pid);
+    return units;
+}
+
+struct victim_policy victim_policies[] = {
+    { "held", cost_held_resources },
+    { "youngest", cost_youngest },
+    { "units", cost_held_units },
+    { NULL, NULL }
+};
+
+/* Picks the cheapest process of a deadlocked set, lower pid wins ties */
+static int choose_victim(int *members, int count)
+{
+    int victim = members[0];
+    long victim_cost_value = victim_cost(victim);
+
+    for (int i = 1; i < count; i++) {
+        long cost = victim_cost(members[i]);
+        if (cost < victim_cost_value || (cost == victim_cost_value && members[i] < victim)) {
+            victim = members[i];
+            victim_cost_value = cost;
+        }
+    }
+    return victim;
+}
+
+static void log_deadlocked(int *members, int count)
+{
+    char procs[1024], procstr[16];
+
+    procs[0] = 0;
+    for (int i = 0; i < count && strlen(procs) < sizeof(procs) - sizeof(procstr); i++) {
+        sprintf(procstr, " P%d", members[i]);
+        strcat(procs, procstr);
+    }
+    forcelogprintf("Processes%s are deadlocked at " OSSTIME_FMT, procs, OSSTIME_ARGS(clock_now()));
+}
+
+/* Finds every deadlocked set with a single strongly connected components pass
+ * and kills one victim from each of them.
+ * A set may still contain a smaller cycle after its victim is gone, so the pass
+ * is repeated until the graph is clear. Each round kills at least one process,
+ * so there are at most pcb_num rounds.
+ */
+static void recover_deadlocks()
+{
+    int members[pcb_num], starts[pcb_num + 1], victims[pcb_num];
+    int nsets, nvictims;
+
+    spend(50, 100);
+    while ((nsets = wfg_deadlocked_sets(members, starts)) > 0) {
+        nvictims = 0;
+        for (int set = 0; set < nsets; set++) {
+            log_deadlocked(&members[starts[set]], starts[set + 1] - starts[set]);
+            victims[nvictims++] = choose_victim(&members[starts[set]], starts[set + 1] - starts[set]);
+        }
+
+        // Killing a victim wakes up others, some victims may not be blocked anymore
+        for (int i = 0; i < nvictims; i++) {
+            if (pcb_state(victims[i]) != S_BLOCKED)
+                continue;
+            forcelogprintf("Process P%d is part of a deadlock", victims[i]);
+            kill_process(victims[i]);
+        }
+    }
+}
+
+/* Checks whether blocking pid closed a cycle in the wait-for graph.
+ * Every cycle formed by its new edges passes through pid, so there's
+ * nothing to recover from unless the search finds its way back to it.
+ */
+void dedeadlock(uint pid)
+{
+    int cycle[pcb_num];
+    struct timespec start, end;
+    int found;
+    long ns;
+
+    // The detector finds it in its next snapshot
+    if (background_detection) {
+        graph_changed = true;
+        return;
+    }
+
+    dedeadlocks_run++;
+    logprintf(true, "Master running deadlock detection for P%d", pid);
+
+    // Only the search is timed, recovery depends on the victims more than the graph
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    found = wfg_find_cycle(pid, cycle) > 0;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+    dedeadlock_ns += ns;
+    stats_detection(ns);
+
+    trace(TR_DETECT, pid, -1, found);
+    if (found)
+        recover_deadlocks();
+}
+
+/* Recovers from the deadlocked sets the detector found in a snapshot.
+ * Processes may have been woken up or killed since it was taken, so a victim
+ * is only killed once a cycle through its set is found in the live graph,
+ * and that's repeated until the set has none left.
+ */
+static void recover_snapshot_sets(int *members, int *starts, int nsets)
+{
+    int cycle[pcb_num], len;
+
+    spend(50, 100);
+    for (int set = 0; set < nsets; set++) {
+        bool live = false;
+        for (int i = starts[set]; i < starts[set + 1]; i++) {
+            if (pcb_state(members[i]) != S_BLOCKED || (len = wfg_find_cycle(members[i], cycle)) == 0)
+                continue;
+            live = true;
+            log_deadlocked(cycle, len);
+            int victim = choose_victim(cycle, len);
+            forcelogprintf("Process P%d is part of a deadlock", victim);
+            kill_process(victim);
+            // The graph has changed, look at the whole set again
+            i = starts[set] - 1;
+        }
+        if (!live)
+            stale_sets++;
+    }
+}
+
+/* With background detection, recovers from what the detector found in its
+ * last snapshot and hands it a new one if anybody got blocked since.
+ * oss calls it between turns, when nothing else changes the graph.
+ */
+void resmgr_poll()
+{
+    int nsets, *members, *starts;
+    long ns;
+    struct timespec start, end;
+
+    if (!background_detection || detector_busy())
+        return;
+
+    if ((nsets = detector_sets(&members, &starts, &ns)) != -1) {
+        dedeadlocks_run++;
+        dedeadlock_ns += ns;
+        stats_detection(ns);
+        if (nsets > 0)
+            recover_snapshot_sets(members, starts, nsets);
+    }
+
+    if (!graph_changed)
+        return;
+    graph_changed = false;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    wfg_snapshot();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    snapshots++;
+    snapshot_ns += (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+    detector_run();
+}
+
+/* Takes back everything pid holds and frees its PCB */
+void resmgr_release_all(int pid)
+{
+	pcb *pcb = &pcbs[pid];
+    char released[1024], resstr[128];
+    released[0] = 0;
+    resstr[0] = 0;
+
+    int cursor = 0, res_id;
+    while ((res_id = held_next(pid, &cursor)) != -1)
+        if (strlen(released) < sizeof(released) - sizeof(resstr)) {
+            sprintf(resstr, " R%d:%d", res_id, units_held(res_id, pid));
+            strcat(released, resstr);
+        }
+    logprintf(false, "Released resources: %s", released);
+    // Not blocked anymore, so releasing below can't wake this process up
+    if (pcb_state(pid) == S_BLOCKED) {
+        waitq_remove(&resources[pcb->blocked_on].queue, pid);
+        stats_unblocked(pid, pcb->blocked_on);
+    }
+    stats_exited(pid);
+    pcb_set_state(pid, S_NOT_STARTED);
+    pcb->claims_known = false;
+    wfg_unblock(pid);
+    cursor = 0;
+    while ((res_id = held_next(pid, &cursor)) != -1) {
+        trace(TR_RECLAIM, pid, res_id, units_held(res_id, pid));
+        units_add(res_id, pid, -units_held(res_id, pid));
+        wake_up_on_resource(res_id);
+    }
+    wake_up_safe();
+    if (avoidance)
+        for (int i = 0; i < resource_num; i++)
+            claim_column(i)[pid] = 0;
+
+    pcb->blocked_on = -1;
+    nwanted[pid] = 0;
+}
@@ -0,0 +1,61 @@
+#ifndef RESMGR_H
+#define RESMGR_H
+
+#include <stdbool.h>
+
+#include "common.h"
+#include "messages.h"
+
+/* Resource management core of oss: granting, blocking and waking up
+ * processes, deadlock detection and recovery.
+ * It works on the PCBs and resources in shm, whoever set the segment up.
+ */
+
+typedef long (*victim_cost_fn)(int pid);
+
+struct victim_policy {
+    const char *name;
+    victim_cost_fn cost;
+};
+
+extern bool avoidance;
+extern bool priority_wakeup;
+extern bool background_detection;
+extern victim_cost_fn victim_cost;
+extern struct victim_policy victim_policies[];
+
+/* statistics */
+extern int requests_granted;
+extern int dedeadlocks_run;
+extern long dedeadlock_ns;
+extern int safe_grants;
+extern int unsafe_denials;
+// Background detection: snapshots taken and time spent taking them, deadlocked sets gone when checked live
+extern int snapshots;
+extern long snapshot_ns;
+extern int stale_sets;
+
+void resmgr_init();
+void resmgr_shutdown();
+void resmgr_poll();
+void resmgr_start(int pid);
+void resmgr_release_all(int pid);
+
+bool resource_available(uint pid, int res_id);
+void resource_requested(uint pid, int res_id);
+void resource_released(uint pid, int res_id);
+void resources_requested(uint pid, const res_amount *items, int n);
+void resources_released(uint pid, const res_amount *items, int n);
+void wake_up_on_resource(int res_id);
+void dedeadlock(uint pid);
+long cost_held_units(int pid);
+void printres();
+
+/* Provided by the program the core is linked into */
+void logprintf(bool time, const char *fmt, ...);
+void forcelogprintf(const char *fmt, ...);
+void send_to_user(uint pid, ipc_message *msg);
+// Gets rid of a deadlock victim, which has to end up in resmgr_release_all()
+void kill_process(int pid);
+
+#endif
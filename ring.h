@@ -0,0 +1,148 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdbool.h>
+
+#include "types.h"
+#include "arena.h"
+
+/* FIFO rings for any element type, which never call malloc.
+ *
+ * RING(name, type) defines name, a ring over a power-of-two array of slots
+ * the caller provides. When every slot is taken, further elements go to
+ * overflow chunks from an arena and move into the slots in order as they
+ * free up, so a ring sized for the usual case still takes the odd burst.
+ * name_push() only fails if there's no arena or it's used up.
+ *
+ * SHMRING(name, type, size) defines name, a fixed ring with its slots inside
+ * the struct and indices instead of pointers, so it works at whatever address
+ * it's mapped, e.g. in the shared memory segment. It has one producer and one
+ * consumer, which may be different processes: each index is written by one
+ * side only, on a cache line of its own, stored with release and loaded with
+ * acquire by the other side. name_push() fails if the ring is full.
+ *
+ * Indices run freely and wrap around, index i is in slot i & (size - 1).
+ */
+
+// Elements in an overflow chunk
+#define RING_CHUNK_ITEMS 32
+
+#define RING(name, type) \
+typedef struct name##_chunk { \
+    struct name##_chunk *next; \
+    uint head; \
+    uint tail; \
+    type items[RING_CHUNK_ITEMS]; \
+} name##_chunk; \
+\
+typedef struct { \
+    type *slots; \
+    uint mask; \
+    uint head; \
+    uint tail; \
+    uint count; \
+    /* Overflow, everything in it was pushed after what's in the slots */ \
+    name##_chunk *first; \
+    name##_chunk *last; \
+    arena *arena; \
+} name; \
+\
+/* Chunks of a are sizeof(name##_chunk), a may be NULL for no overflow */ \
+static inline void name##_init(name *r, type *slots, uint size, arena *a) { \
+    r->slots = slots; \
+    r->mask = size - 1; \
+    r->head = r->tail = r->count = 0; \
+    r->first = r->last = NULL; \
+    r->arena = a; \
+} \
+\
+static inline uint name##_count(const name *r) { \
+    return r->count; \
+} \
+\
+static inline bool name##_empty(const name *r) { \
+    return r->count == 0; \
+} \
+\
+static inline bool name##_push(name *r, type v) { \
+    if (r->first == NULL && r->tail - r->head <= r->mask) { \
+        r->slots[r->tail++ & r->mask] = v; \
+    } else { \
+        name##_chunk *c = r->last; \
+        if (c == NULL || c->tail == RING_CHUNK_ITEMS) { \
+            if (r->arena == NULL || (c = arena_get(r->arena)) == NULL) \
+                return false; \
+            c->next = NULL; \
+            c->head = c->tail = 0; \
+            if (r->last) \
+                r->last->next = c; \
+            else \
+                r->first = c; \
+            r->last = c; \
+        } \
+        c->items[c->tail++] = v; \
+    } \
+    r->count++; \
+    return true; \
+} \
+\
+/* Oldest element, the ring mustn't be empty */ \
+static inline type name##_peek(const name *r) { \
+    return r->slots[r->head & r->mask]; \
+} \
+\
+static inline bool name##_pop(name *r, type *v) { \
+    if (r->count == 0) \
+        return false; \
+    *v = r->slots[r->head++ & r->mask]; \
+    r->count--; \
+    /* The slots are full while there's overflow, its oldest element takes the freed slot */ \
+    if (r->first != NULL) { \
+        name##_chunk *c = r->first; \
+        r->slots[r->tail++ & r->mask] = c->items[c->head++]; \
+        if (c->head == c->tail) { \
+            r->first = c->next; \
+            if (r->first == NULL) \
+                r->last = NULL; \
+            arena_put(r->arena, c); \
+        } \
+    } \
+    return true; \
+}
+
+#define SHMRING(name, type, size) \
+_Static_assert(((size) & ((size) - 1)) == 0, #name " size must be a power of two"); \
+\
+typedef struct { \
+    uint head __attribute__((aligned(CACHE_LINE))); \
+    /* Set by a consumer parked on tail, for callers that park */ \
+    uint waiting; \
+    uint tail __attribute__((aligned(CACHE_LINE))); \
+    type slots[size]; \
+} name; \
+\
+static inline bool name##_empty(name *r) { \
+    return __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == r->head; \
+} \
+\
+/* Producer side */ \
+static inline bool name##_push(name *r, const type *v) { \
+    uint tail = r->tail; \
+    if (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) >= (size)) \
+        return false; \
+    r->slots[tail & ((size) - 1)] = *v; \
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE); \
+    return true; \
+} \
+\
+/* Consumer side */ \
+static inline bool name##_pop(name *r, type *v) { \
+    uint head = r->head; \
+    if (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == head) \
+        return false; \
+    *v = r->slots[head & ((size) - 1)]; \
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE); \
+    return true; \
+}
+
+#endif
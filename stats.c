@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+
+/* This module keeps the statistics in the shared memory segment and writes
+ * snapshots of them out.
+ *
+ * Manager threads (-m) update the histograms at the same time, so those are
+ * added to atomically. Resource stats are only changed by the thread owning
+ * the resource and PCB stats by the thread handling the process, like the
+ * rest of their data. Snapshots are written by oss between turns, when
+ * nothing changes.
+ *
+ * The CSV file gets one row per value and snapshot, so a run's file can be
+ * loaded as a table with columns time, scope, id, metric and value. The
+ * OpenMetrics file always holds the latest snapshot, it's written to a
+ * temporary file and renamed over the old one so a scraper never sees half.
+ */
+
+// Wall clock time between snapshots
+#define STATS_PERIOD_NS 500000000L
+
+const char *histogram_names[H_COUNT] = {
+    "grant_latency_sim", "grant_latency_wall", "blocked_time", "queue_depth", "detection_time"
+};
+
+static FILE *csv;
+static const char *om_path;
+static long started;
+static long last_export;
+
+static long wall_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void hist_add(histogram_id id, ulong value) {
+    histogram *h = &shm_stats->hist[id];
+    int b = value ? 64 - __builtin_clzl(value) : 0;
+    ulong max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->buckets[b < STATS_BUCKETS ? b : STATS_BUCKETS - 1], 1, __ATOMIC_RELAXED);
+    while (value > max && !__atomic_compare_exchange_n(&h->max, &max, value, true, __ATOMIC_RELAXED,
+                __ATOMIC_RELAXED))
+        ;
+}
+
+/* Returns the upper bound of the bucket holding the q-th fraction of the values */
+static ulong hist_quantile(const histogram *h, double q) {
+    ulong rank = (ulong)(q * h->count), seen = 0;
+
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen > rank)
+            return b == 0 ? 0 : min((1UL << b) - 1, h->max);
+    }
+    return h->max;
+}
+
+/* Clears everything, after the segment has been laid out */
+void stats_init() {
+    memset(shm_stats, 0, sizeof(stats_page));
+    memset(shm_res_stats, 0, resource_num * sizeof(res_stats));
+    memset(shm_pcb_stats, 0, pcb_num * sizeof(pcb_stats));
+}
+
+void stats_requested(int pid, int res_id) {
+    pcb_stats *p = &shm_pcb_stats[pid];
+
+    shm_res_stats[res_id].requests++;
+    p->requests++;
+    p->pending = true;
+    p->requested_at = clock_now();
+    p->requested_wall = wall_ns();
+}
+
+void stats_blocked(int pid, int res_id, int queue_len) {
+    res_stats *r = &shm_res_stats[res_id];
+
+    r->waits++;
+    r->max_queue = max(r->max_queue, (uint)queue_len);
+    shm_pcb_stats[pid].blocks++;
+    shm_pcb_stats[pid].blocked_at = clock_now();
+    hist_add(H_QUEUE, queue_len);
+}
+
+/* pid isn't blocked on res_id anymore, granted or killed */
+void stats_unblocked(int pid, int res_id) {
+    pcb_stats *p = &shm_pcb_stats[pid];
+    ulong blocked = osstime_sub(clock_now(), p->blocked_at);
+
+    shm_res_stats[res_id].wait_ns += blocked;
+    p->blocked_ns += blocked;
+    hist_add(H_BLOCKED, blocked);
+}
+
+/* pid is gone, killed or terminated, with whatever it was waiting for */
+void stats_exited(int pid) {
+    shm_pcb_stats[pid].pending = false;
+}
+
+void stats_granted(int pid, int res_id) {
+    pcb_stats *p = &shm_pcb_stats[pid];
+
+    shm_res_stats[res_id].grants++;
+    p->grants++;
+    if (!p->pending)
+        return;
+    p->pending = false;
+    ulong latency = osstime_sub(clock_now(), p->requested_at);
+    p->max_grant_ns = max(p->max_grant_ns, latency);
+    hist_add(H_GRANT_SIM, latency);
+    hist_add(H_GRANT_WALL, wall_ns() - p->requested_wall);
+}
+
+void stats_detection(long ns) {
+    hist_add(H_DETECTION, ns);
+}
+
+/* Upper bound of the q-th quantile of a histogram, rounded up to its bucket */
+ulong stats_quantile(histogram_id id, double q) {
+    return hist_quantile(&shm_stats->hist[id], q);
+}
+
+static void csv_row(long ms, osstime now, const char *scope, int id, const char *metric, ulong value) {
+    fprintf(csv, "%ld," OSSTIME_FMT ",%s,%d,%s,%lu\n", ms, OSSTIME_ARGS(now), scope, id, metric, value);
+}
+
+static void export_csv(long ms) {
+    osstime now = clock_now();
+    char metric[64];
+
+    for (int i = 0; i < H_COUNT; i++) {
+        const histogram *h = &shm_stats->hist[i];
+        static const struct { const char *name; double q; } quantiles[] = {
+            { "p50", 0.5 }, { "p90", 0.9 }, { "p99", 0.99 }, { "p999", 0.999 }
+        };
+        sprintf(metric, "%s_count", histogram_names[i]);
+        csv_row(ms, now, "all", -1, metric, h->count);
+        sprintf(metric, "%s_sum", histogram_names[i]);
+        csv_row(ms, now, "all", -1, metric, h->sum);
+        for (int q = 0; q < 4; q++) {
+            sprintf(metric, "%s_%s", histogram_names[i], quantiles[q].name);
+            csv_row(ms, now, "all", -1, metric, hist_quantile(h, quantiles[q].q));
+        }
+        sprintf(metric, "%s_max", histogram_names[i]);
+        csv_row(ms, now, "all", -1, metric, h->max);
+    }
+    for (int r = 0; r < resource_num; r++) {
+        res_stats *s = &shm_res_stats[r];
+        csv_row(ms, now, "resource", r, "requests", s->requests);
+        csv_row(ms, now, "resource", r, "grants", s->grants);
+        csv_row(ms, now, "resource", r, "waits", s->waits);
+        csv_row(ms, now, "resource", r, "wait_ns", s->wait_ns);
+        csv_row(ms, now, "resource", r, "queue", resources[r].queue.count);
+        csv_row(ms, now, "resource", r, "max_queue", s->max_queue);
+    }
+    for (int pid = 0; pid < pcb_num; pid++) {
+        pcb_stats *s = &shm_pcb_stats[pid];
+        csv_row(ms, now, "pcb", pid, "requests", s->requests);
+        csv_row(ms, now, "pcb", pid, "grants", s->grants);
+        csv_row(ms, now, "pcb", pid, "blocks", s->blocks);
+        csv_row(ms, now, "pcb", pid, "blocked_ns", s->blocked_ns);
+        csv_row(ms, now, "pcb", pid, "max_grant_ns", s->max_grant_ns);
+    }
+    fflush(csv);
+}
+
+/* Writes a histogram of nanoseconds in seconds, or of plain numbers if seconds is false */
+static void om_histogram(FILE *f, histogram_id id, bool seconds, const char *help) {
+    const histogram *h = &shm_stats->hist[id];
+    const char *unit = seconds ? "_seconds" : "";
+    double scale = seconds ? 1e-9 : 1;
+    ulong cumulative = 0;
+
+    fprintf(f, "# TYPE oss_%s%s histogram\n", histogram_names[id], unit);
+    fprintf(f, "# HELP oss_%s%s %s\n", histogram_names[id], unit, help);
+    for (int b = 0; b < STATS_BUCKETS - 1; b++) {
+        cumulative += h->buckets[b];
+        // Values are whole numbers, so bucket b holds everything up to 2^b - 1
+        fprintf(f, "oss_%s%s_bucket{le=\"%g\"} %lu\n", histogram_names[id], unit,
+                ((1UL << b) - 1) * scale, cumulative);
+    }
+    fprintf(f, "oss_%s%s_bucket{le=\"+Inf\"} %lu\n", histogram_names[id], unit, h->count);
+    fprintf(f, "oss_%s%s_count %lu\n", histogram_names[id], unit, h->count);
+    fprintf(f, "oss_%s%s_sum %g\n", histogram_names[id], unit, h->sum * scale);
+}
+
+static void export_openmetrics() {
+    char tmp[4096];
+    FILE *f;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", om_path);
+    if ((f = fopen(tmp, "w")) == NULL) {
+        perror("stats open");
+        return;
+    }
+
+    om_histogram(f, H_GRANT_SIM, true, "Time from request to grant in simulated time.");
+    om_histogram(f, H_GRANT_WALL, true, "Time from request to grant in wall clock time.");
+    om_histogram(f, H_BLOCKED, true, "Simulated time processes spent blocked.");
+    om_histogram(f, H_QUEUE, false, "Length of the wait queue a blocked process joined.");
+    om_histogram(f, H_DETECTION, true, "Duration of deadlock detection passes.");
+
+    fprintf(f, "# TYPE oss_simulated_time_seconds gauge\n");
+    fprintf(f, "oss_simulated_time_seconds %g\n", clock_now() * 1e-9);
+
+    fprintf(f, "# TYPE oss_resource_requests counter\n");
+    for (int r = 0; r < resource_num; r++)
+        fprintf(f, "oss_resource_requests_total{resource=\"%d\"} %lu\n", r, shm_res_stats[r].requests);
+    fprintf(f, "# TYPE oss_resource_grants counter\n");
+    for (int r = 0; r < resource_num; r++)
+        fprintf(f, "oss_resource_grants_total{resource=\"%d\"} %lu\n", r, shm_res_stats[r].grants);
+    fprintf(f, "# TYPE oss_resource_waits counter\n");
+    for (int r = 0; r < resource_num; r++)
+        fprintf(f, "oss_resource_waits_total{resource=\"%d\"} %lu\n", r, shm_res_stats[r].waits);
+    fprintf(f, "# TYPE oss_resource_wait_seconds counter\n");
+    for (int r = 0; r < resource_num; r++)
+        fprintf(f, "oss_resource_wait_seconds_total{resource=\"%d\"} %g\n", r, shm_res_stats[r].wait_ns * 1e-9);
+    fprintf(f, "# TYPE oss_resource_queue gauge\n");
+    for (int r = 0; r < resource_num; r++)
+        fprintf(f, "oss_resource_queue{resource=\"%d\"} %d\n", r, resources[r].queue.count);
+    fprintf(f, "# TYPE oss_resource_queue_max gauge\n");
+    for (int r = 0; r < resource_num; r++)
+        fprintf(f, "oss_resource_queue_max{resource=\"%d\"} %u\n", r, shm_res_stats[r].max_queue);
+
+    fprintf(f, "# TYPE oss_pcb_requests counter\n");
+    for (int pid = 0; pid < pcb_num; pid++)
+        fprintf(f, "oss_pcb_requests_total{pcb=\"%d\"} %lu\n", pid, shm_pcb_stats[pid].requests);
+    fprintf(f, "# TYPE oss_pcb_grants counter\n");
+    for (int pid = 0; pid < pcb_num; pid++)
+        fprintf(f, "oss_pcb_grants_total{pcb=\"%d\"} %lu\n", pid, shm_pcb_stats[pid].grants);
+    fprintf(f, "# TYPE oss_pcb_blocks counter\n");
+    for (int pid = 0; pid < pcb_num; pid++)
+        fprintf(f, "oss_pcb_blocks_total{pcb=\"%d\"} %lu\n", pid, shm_pcb_stats[pid].blocks);
+    fprintf(f, "# TYPE oss_pcb_blocked_seconds counter\n");
+    for (int pid = 0; pid < pcb_num; pid++)
+        fprintf(f, "oss_pcb_blocked_seconds_total{pcb=\"%d\"} %g\n", pid, shm_pcb_stats[pid].blocked_ns * 1e-9);
+    fprintf(f, "# TYPE oss_pcb_max_grant_latency_seconds gauge\n");
+    for (int pid = 0; pid < pcb_num; pid++)
+        fprintf(f, "oss_pcb_max_grant_latency_seconds{pcb=\"%d\"} %g\n", pid, shm_pcb_stats[pid].max_grant_ns * 1e-9);
+    fprintf(f, "# EOF\n");
+
+    fclose(f);
+    if (rename(tmp, om_path) == -1)
+        perror("stats rename");
+}
+
+static void export() {
+    long now = wall_ns();
+
+    last_export = now;
+    if (csv)
+        export_csv((now - started) / 1000000);
+    if (om_path)
+        export_openmetrics();
+}
+
+/* Starts exporting snapshots to the given files, either may be NULL */
+void stats_open(const char *csv_path, const char *openmetrics_path) {
+    if (csv_path) {
+        if ((csv = fopen(csv_path, "w")) == NULL) {
+            perror("stats open");
+            exit(1);
+        }
+        fprintf(csv, "wall_ms,sim_time,scope,id,metric,value\n");
+    }
+    om_path = openmetrics_path;
+    started = last_export = wall_ns();
+}
+
+/* Exports a snapshot if it's time for one */
+void stats_tick() {
+    if ((csv || om_path) && wall_ns() - last_export >= STATS_PERIOD_NS)
+        export();
+}
+
+/* Exports the final snapshot and closes the files */
+void stats_close() {
+    if (!csv && !om_path)
+        return;
+    export();
+    if (csv)
+        fclose(csv);
+    csv = NULL;
+    om_path = NULL;
+}
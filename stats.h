@@ -0,0 +1,78 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+
+#include "types.h"
+#include "osstime.h"
+
+/* Statistics oss keeps in the shared memory segment while it runs, so they
+ * can be looked at by mapping it (/proc/<oss pid>/fd/<OSS_SHM_FD>) as well as
+ * in the exported files.
+ *
+ * Histograms have log2 buckets: bucket b > 0 holds values in [2^(b-1), 2^b),
+ * bucket 0 holds zeros. Times are in nanoseconds, simulated or wall clock
+ * as the name says.
+ */
+
+#define STATS_BUCKETS 48
+
+typedef struct {
+    ulong count;
+    ulong sum;
+    ulong max;
+    ulong buckets[STATS_BUCKETS];
+} histogram;
+
+typedef enum {
+    H_GRANT_SIM,        // request to grant, simulated
+    H_GRANT_WALL,       // request to grant, wall clock
+    H_BLOCKED,          // time spent S_BLOCKED, simulated
+    H_QUEUE,            // processes in the wait queue a blocked process joins, itself included
+    H_DETECTION,        // deadlock detection pass, wall clock
+    H_COUNT
+} histogram_id;
+
+/* The fixed-size part, a histogram of each kind over all resources and PCBs */
+typedef struct {
+    histogram hist[H_COUNT];
+} stats_page;
+
+typedef struct {
+    ulong requests;
+    ulong grants;
+    // Requests that had to wait and their total time in the queue, simulated
+    ulong waits;
+    ulong wait_ns;
+    uint max_queue;
+} res_stats;
+
+typedef struct {
+    ulong requests;
+    ulong grants;
+    ulong blocks;
+    ulong blocked_ns;
+    ulong max_grant_ns;
+    // Request waiting to be granted, if pending
+    bool pending;
+    osstime requested_at;
+    ulong requested_wall;
+    osstime blocked_at;
+} pcb_stats;
+
+extern const char *histogram_names[H_COUNT];
+
+void stats_init();
+void stats_requested(int pid, int res_id);
+void stats_blocked(int pid, int res_id, int queue_len);
+void stats_unblocked(int pid, int res_id);
+void stats_granted(int pid, int res_id);
+void stats_exited(int pid);
+void stats_detection(long ns);
+ulong stats_quantile(histogram_id id, double q);
+
+void stats_open(const char *csv_path, const char *openmetrics_path);
+void stats_tick();
+void stats_close();
+
+#endif
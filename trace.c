@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+/* This module writes the trace file.
+ * Address space for the largest allowed file is mapped once at the start and
+ * the file itself grows in TRACE_GROW steps as events are recorded, so the
+ * mapping never moves and trace() only checks there's room.
+ * Without a file the trace is kept in anonymous memory reserved the same way.
+ */
+
+#define TRACE_RESERVE (1UL << 30)
+#define TRACE_GROW (4UL << 20)
+
+trace_event *trace_events = NULL;
+ulong trace_count = 0;
+ulong trace_room = 0;
+ulong trace_lost = 0;
+
+static int fd = -1;
+static char *map;
+static size_t file_size;
+
+static void resize(size_t size) {
+    if (fd != -1 && ftruncate(fd, size) == -1) {
+        perror("trace ftruncate");
+        exit(1);
+    }
+    file_size = size;
+    trace_room = (file_size - sizeof(trace_header)) / sizeof(trace_event);
+}
+
+/* Starts recording to path, or to memory if it's NULL.
+ * Returns the header for the caller to fill in the options of the run. */
+trace_header *trace_open(const char *path) {
+    trace_header *hdr;
+
+    if (path == NULL) {
+        fd = -1;
+        map = mmap(NULL, TRACE_RESERVE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    } else {
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            perror("trace open");
+            exit(1);
+        }
+        map = mmap(NULL, TRACE_RESERVE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (map == MAP_FAILED) {
+        perror("trace mmap");
+        exit(1);
+    }
+    resize(TRACE_GROW);
+
+    hdr = (trace_header *)map;
+    memcpy(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic));
+    hdr->version = TRACE_VERSION;
+    hdr->event_size = sizeof(trace_event);
+    hdr->pcb_num = pcb_num;
+    hdr->resource_num = resource_num;
+    hdr->ticks_per_sec = OSSTIME_TICKS_PER_SEC;
+    trace_events = (trace_event *)(map + sizeof(trace_header));
+    trace_count = 0;
+    trace_lost = 0;
+    return hdr;
+}
+
+/* Makes room for more events, unless the file has reached its largest size */
+void trace_grow() {
+    ((trace_header *)map)->synced = trace_count;
+    if (file_size + TRACE_GROW <= TRACE_RESERVE)
+        resize(file_size + TRACE_GROW);
+}
+
+/* Finishes the header and cuts the file to the events recorded */
+void trace_close() {
+    trace_header *hdr = (trace_header *)map;
+
+    if (trace_events == NULL)
+        return;
+    hdr->count = trace_count;
+    hdr->lost = trace_lost;
+    trace_events = NULL;
+    munmap(map, TRACE_RESERVE);
+    if (fd == -1)
+        return;
+    if (ftruncate(fd, sizeof(trace_header) + trace_count * sizeof(trace_event)) == -1)
+        perror("trace ftruncate");
+    close(fd);
+    fd = -1;
+}
+
+/* Maps a trace file read-only and checks its header.
+ * Returns its events, their number in count and the header in hdr. */
+trace_event *trace_map(const char *path, trace_header **hdr, ulong *count) {
+    struct stat st;
+    int in = open(path, O_RDONLY);
+    char *file;
+    trace_event *events;
+
+    if (in == -1 || fstat(in, &st) == -1) {
+        perror(path);
+        exit(1);
+    }
+    if ((size_t)st.st_size < sizeof(trace_header)) {
+        fprintf(stderr, "%s: not a trace\n", path);
+        exit(1);
+    }
+    file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in, 0);
+    if (file == MAP_FAILED) {
+        perror("trace mmap");
+        exit(1);
+    }
+    close(in);
+
+    *hdr = (trace_header *)file;
+    if (memcmp((*hdr)->magic, TRACE_MAGIC, sizeof((*hdr)->magic)) || (*hdr)->version != TRACE_VERSION
+            || (*hdr)->event_size != sizeof(trace_event)) {
+        fprintf(stderr, "%s: not a trace of this version\n", path);
+        exit(1);
+    }
+
+    events = (trace_event *)(file + sizeof(trace_header));
+    *count = (*hdr)->count;
+    if (*count == 0) {
+        // oss didn't get to close the trace, read on from the last synced count up to
+        // the zeroes at the end of the file
+        ulong room = (st.st_size - sizeof(trace_header)) / sizeof(trace_event);
+        *count = min((*hdr)->synced, room);
+        while (*count < room && events[*count].type != 0)
+            (*count)++;
+        if (*count > 0)
+            fprintf(stderr, "%s: trace wasn't closed, read %lu events\n", path, *count);
+    }
+    return events;
+}
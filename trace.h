@@ -0,0 +1,118 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "common.h"
+
+/* Binary trace of what oss does, written with -T and read by tracedump.
+ *
+ * The file is a trace_header followed by fixed-size trace_events in the order
+ * they happened. It's written through a shared memory mapping, so recording an
+ * event is a few stores and no system call.
+ *
+ * What users did (spawn, claim, request, release, terminate) is enough to run
+ * the allocator again and get every other event back, which is what oss -R does.
+ */
+
+#define TRACE_MAGIC "OSSTRACE"
+#define TRACE_VERSION 3
+
+/* No event has type 0, so the zeroes after the last event of a trace oss
+ * didn't close tell where it ends */
+typedef enum {
+    // pid got a PCB
+    TR_SPAWN = 1,
+    // pid asked for a unit of res_id, or for arg units as an item of a TR_REQUEST_MANY
+    TR_REQUEST,
+    // pid got a unit of res_id, or arg units as an item of an all-or-nothing request
+    TR_GRANT,
+    // pid has to wait for res_id, arg is 1 if the banker's algorithm said no
+    TR_BLOCK,
+    // pid stopped waiting for res_id, it's granted right after unless it's
+    // blocked on the next resource of an all-or-nothing request
+    TR_UNBLOCK,
+    // pid gave back arg units of res_id
+    TR_RELEASE,
+    // pid killed to break a deadlock
+    TR_KILL,
+    // pid finished normally
+    TR_TERMINATE,
+    // Deadlock detection after pid got blocked, arg is 1 if it found a cycle
+    TR_DETECT,
+    // Configuration of res_id written at start, arg is the limit, pid is 1 if shareable
+    TR_RESOURCE,
+    // pid declared a maximum claim of arg units of res_id, avoidance mode only
+    TR_CLAIM,
+    // oss took back arg units of res_id from pid, which terminated or was killed
+    TR_RECLAIM,
+    // pid asked for or gave back arg resources at once, res_id is -1 and the
+    // next arg events are the TR_REQUESTs or TR_RELEASEs of the items
+    TR_REQUEST_MANY,
+    TR_RELEASE_MANY,
+    TR_TYPES
+} trace_type;
+
+typedef struct {
+    char magic[8];
+    uint version;
+    uint event_size;
+    int pcb_num;
+    int resource_num;
+    // Number of events in the file, 0 until oss closes the trace
+    ulong count;
+    // Events known to be written while recording, updated whenever the file grows
+    ulong synced;
+    // Events that didn't fit in the file
+    ulong lost;
+    // Clock ticks per simulated second, for converting event times
+    ulong ticks_per_sec;
+    // Options of the run, TRF_*
+    uint flags;
+    // Victim policy of the run, index in oss's victim_policies[]
+    int victim_policy;
+} trace_header;
+
+#define TRF_AVOIDANCE 1
+#define TRF_PRIORITY_WAKEUP 2
+
+typedef struct {
+    // Simulated clock in ticks
+    ulong time;
+    uint type;
+    int pid;
+    int res_id;
+    int arg;
+} trace_event;
+
+/* Events of the mapped file, NULL if not tracing */
+extern trace_event *trace_events;
+extern ulong trace_count;
+extern ulong trace_room;
+extern ulong trace_lost;
+
+trace_header *trace_open(const char *path);
+void trace_close();
+void trace_grow();
+trace_event *trace_map(const char *path, trace_header **hdr, ulong *count);
+
+/* Records an event at the current simulated time */
+static inline void trace(trace_type type, int pid, int res_id, int arg) {
+    trace_event *e;
+
+    if (trace_events == NULL)
+        return;
+    if (trace_count == trace_room) {
+        trace_grow();
+        if (trace_count == trace_room) {
+            trace_lost++;
+            return;
+        }
+    }
+    e = &trace_events[trace_count++];
+    e->time = clock_now();
+    e->type = type;
+    e->pid = pid;
+    e->res_id = res_id;
+    e->arg = arg;
+}
+
+#endif
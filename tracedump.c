@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/* Decodes trace files written by oss -T.
+ * Prints the events matching the filters, or with -s a summary of them:
+ * event counts, how long requests waited for a grant and how contended
+ * every resource was.
+ */
+
+static const char *type_names[TR_TYPES] = {
+    [TR_SPAWN] = "spawn", "request", "grant", "block", "unblock", "release", "kill", "terminate", "detect",
+    "resource", "claim", "reclaim", "request_many", "release_many"
+};
+
+/* Latency histogram buckets, bucket b > 0 holds latencies in [2^(b-1), 2^b) ticks */
+#define BUCKETS 40
+
+typedef struct {
+    bool shared;
+    int limit;
+    ulong requests;
+    ulong grants;
+    ulong blocks;
+    ulong unsafe_blocks;
+    ulong waited;
+    ulong total_wait;
+    ulong max_wait;
+    int queued;
+    int max_queued;
+} res_summary;
+
+static trace_header *hdr;
+static ulong ticks_per_sec;
+// Digits of a fraction of a second in ticks
+static int tick_digits;
+static ulong count;
+// Filters, -1 matches everything
+static uint type_mask = ~0U;
+static int pid_filter = -1;
+static int res_filter = -1;
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-s] [-e type[,type...]] [-p pid] [-r resource] trace\n", prog);
+    fprintf(stderr, "  -s  print a summary instead of the events\n");
+    fprintf(stderr, "  -e  only events of these types:");
+    for (int i = TR_SPAWN; i < TR_TYPES; i++)
+        fprintf(stderr, " %s", type_names[i]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -p  only events of this PCB\n");
+    fprintf(stderr, "  -r  only events of this resource\n");
+    exit(1);
+}
+
+static uint parse_types(char *list, const char *prog)
+{
+    uint mask = 0;
+
+    for (char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+        int i = TR_SPAWN;
+        while (i < TR_TYPES && strcmp(name, type_names[i]))
+            i++;
+        if (i == TR_TYPES)
+            usage(prog);
+        mask |= 1U << i;
+    }
+    return mask;
+}
+
+static bool matches(trace_event *e)
+{
+    return (type_mask >> e->type & 1) && (pid_filter == -1 || e->pid == pid_filter)
+        && (res_filter == -1 || e->res_id == res_filter);
+}
+
+static void print_events(trace_event *events)
+{
+    for (ulong i = 0; i < count; i++) {
+        trace_event *e = &events[i];
+        if (!matches(e))
+            continue;
+        printf("%lu.%0*lu %-9s", e->time / ticks_per_sec, tick_digits, e->time % ticks_per_sec,
+                e->type >= TR_SPAWN && e->type < TR_TYPES ? type_names[e->type] : "?");
+        if (e->type == TR_RESOURCE)
+            printf(" R%d limit %d%s\n", e->res_id, e->arg, e->pid ? " shareable" : "");
+        else if (e->res_id == -1)
+            printf(" P%d %d\n", e->pid, e->arg);
+        else
+            printf(" P%d R%d %d\n", e->pid, e->res_id, e->arg);
+    }
+}
+
+static int compare_ulong(const void *a, const void *b)
+{
+    ulong x = *(const ulong *)a, y = *(const ulong *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_latencies(ulong *latencies, ulong n)
+{
+    ulong buckets[BUCKETS] = { 0 };
+
+    printf("\nGrant latency (ticks from request to grant), %lu grants\n", n);
+    if (n == 0)
+        return;
+    qsort(latencies, n, sizeof(ulong), compare_ulong);
+    printf("p50 %lu  p90 %lu  p99 %lu  max %lu\n", latencies[n / 2], latencies[n * 9 / 10],
+            latencies[n * 99 / 100], latencies[n - 1]);
+
+    for (ulong i = 0; i < n; i++) {
+        int b = latencies[i] ? 64 - __builtin_clzl(latencies[i]) : 0;
+        buckets[b < BUCKETS ? b : BUCKETS - 1]++;
+    }
+    for (int b = 0; b < BUCKETS; b++) {
+        if (buckets[b] == 0)
+            continue;
+        int bar = buckets[b] * 50 / n;
+        if (b == 0)
+            printf("%10s %10d ", "", 0);
+        else
+            printf("%10lu %10lu ", 1UL << (b - 1), (1UL << b) - 1);
+        printf("%8lu %5.1f%% %.*s\n", buckets[b], 100.0 * buckets[b] / n, bar,
+                "##################################################");
+    }
+}
+
+static void summarize(trace_event *events)
+{
+    int npcbs = hdr->pcb_num, nres = hdr->resource_num;
+    ulong counts[TR_TYPES] = { 0 };
+    ulong *request_time = calloc(npcbs, sizeof(ulong));
+    int *request_res = malloc(npcbs * sizeof(int));
+    int *blocked_on = malloc(npcbs * sizeof(int));
+    res_summary *res = calloc(nres, sizeof(res_summary));
+    ulong *latencies = malloc(count * sizeof(ulong));
+    ulong nlatencies = 0;
+
+    for (int i = 0; i < npcbs; i++)
+        request_res[i] = blocked_on[i] = -1;
+
+    // Every event is followed to keep track of queues and pending requests,
+    // only the ones matching the filters are counted
+    for (ulong i = 0; i < count; i++) {
+        trace_event *e = &events[i];
+        bool counted = matches(e);
+        res_summary *r = e->res_id >= 0 && e->res_id < nres ? &res[e->res_id] : NULL;
+        int pid = e->pid;
+
+        if (e->type < TR_SPAWN || e->type >= TR_TYPES)
+            continue;
+        if (counted)
+            counts[e->type]++;
+
+        switch (e->type) {
+        case TR_RESOURCE:
+            r->shared = e->pid;
+            r->limit = e->arg;
+            break;
+        case TR_REQUEST:
+            r->requests += counted;
+            request_time[pid] = e->time;
+            request_res[pid] = e->res_id;
+            break;
+        case TR_BLOCK:
+            r->blocks += counted;
+            r->unsafe_blocks += counted && e->arg;
+            r->max_queued = max(r->max_queued, ++r->queued);
+            blocked_on[pid] = e->res_id;
+            break;
+        case TR_UNBLOCK:
+            r->queued--;
+            blocked_on[pid] = -1;
+            break;
+        case TR_GRANT:
+            r->grants += counted;
+            if (counted && request_res[pid] == e->res_id) {
+                ulong wait = e->time - request_time[pid];
+                latencies[nlatencies++] = wait;
+                if (wait > 0) {
+                    r->waited++;
+                    r->total_wait += wait;
+                    r->max_wait = max(r->max_wait, wait);
+                }
+            }
+            request_res[pid] = -1;
+            break;
+        case TR_KILL:
+        case TR_TERMINATE:
+            // A process blocked when it goes away leaves the queue without a grant
+            if (blocked_on[pid] != -1)
+                res[blocked_on[pid]].queued--;
+            blocked_on[pid] = request_res[pid] = -1;
+            break;
+        default:
+            break;
+        }
+    }
+
+    printf("%lu events, %d PCBs, %d resources", count, npcbs, nres);
+    if (hdr->lost)
+        printf(", %lu events lost", hdr->lost);
+    printf("\n");
+    for (int t = TR_SPAWN; t < TR_TYPES; t++)
+        printf("%-10s %lu\n", type_names[t], counts[t]);
+
+    print_latencies(latencies, nlatencies);
+
+    printf("\nContention per resource\n");
+    printf("%-5s %5s %5s %9s %9s %9s %7s %9s %12s %12s %6s\n", "res", "limit", "share", "requests",
+            "grants", "blocks", "blocked", "unsafe", "mean wait", "max wait", "queue");
+    for (int i = 0; i < nres; i++) {
+        res_summary *r = &res[i];
+        if ((res_filter != -1 && i != res_filter) || r->requests == 0)
+            continue;
+        printf("R%-4d %5d %5s %9lu %9lu %9lu %6.1f%% %9lu %12lu %12lu %6d\n", i, r->limit,
+                r->shared ? "yes" : "no", r->requests, r->grants, r->blocks,
+                100.0 * r->blocks / r->requests, r->unsafe_blocks,
+                r->waited ? r->total_wait / r->waited : 0, r->max_wait, r->max_queued);
+    }
+
+    free(request_time);
+    free(request_res);
+    free(blocked_on);
+    free(res);
+    free(latencies);
+}
+
+int main(int argc, char *argv[])
+{
+    bool summary = false;
+    trace_event *events;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "se:p:r:")) != -1) {
+        switch (opt) {
+        case 's':
+            summary = true;
+            break;
+        case 'e':
+            type_mask = parse_types(optarg, argv[0]);
+            break;
+        case 'p':
+            pid_filter = atoi(optarg);
+            break;
+        case 'r':
+            res_filter = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usage(argv[0]);
+
+    events = trace_map(argv[optind], &hdr, &count);
+    ticks_per_sec = hdr->ticks_per_sec;
+    for (ulong t = ticks_per_sec; t > 1; t /= 10)
+        tick_digits++;
+    if (summary)
+        summarize(events);
+    else
+        print_events(events);
+    return 0;
+}
@@ -5,4 +5,6 @@ typedef unsigned long ulong;
 typedef unsigned int uint;
 typedef unsigned char uchar;
 
+#define CACHE_LINE 64
+
 #endif
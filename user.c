@@ -7,7 +7,6 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
-#include <sys/msg.h>
 #include <sys/shm.h>
 #include <signal.h>
 #include <time.h>
@@ -15,21 +14,16 @@
 
 #include "common.h"
 #include "messages.h"
+#include "channel.h"
+#include "behaviour.h"
+#include "log.h"
 
-#define DEBUG
-
-#ifdef DEBUG
-FILE *log_file;
-#define LOG(...) { fprintf(log_file, __VA_ARGS__); fprintf(log_file, "\n"); fflush(log_file); }
-#else
-#define LOG(...) {}
-#endif
+#define LOG(...) log_line(L_DEBUG, __VA_ARGS__)
 
 int running = true;
-osstime start_time;
-osstime next_term;
-osstime next_res;
-int allocated[RESOURCE_NUM];
+user_state state;
+// A pool worker, which becomes a new user on every RESET instead of exiting
+bool pool = false;
 
 void signalHandler(int sig) {
 
@@ -37,6 +31,7 @@ void signalHandler(int sig) {
 		case SIGUSR1:
 			printf("user signal exiting %d\n", sig);
             running = false;
+            channel_interrupt();
 			break;
 
 		default:
@@ -44,18 +39,8 @@ void signalHandler(int sig) {
 	}	
 }
 
-void res_allocate(int id)
-{
-    allocated[id]++;
-}
-
-void res_deallocate(int id)
-{
-    allocated[id]--;
-}
-
 unsigned int pid;
-pcb *my_pcb;
+uint seed;
 
 void init() {
 	if (signal(SIGUSR1, signalHandler) == SIG_ERR) {
@@ -64,105 +49,52 @@ void init() {
 	}
 
 	/* open shared memory that was created by OSS */
-    allocate();
-	attach();
-
-	/* use pid to initialize random */
-	srand(getpid());
-
-	my_pcb = &shm->pcbs[pid];
-
-}
-
-void terminate()
-{
-    ipc_message msg;
-    msg._msgtyp = 0;
-    if (chance(20)) {
-        LOG("Terminating normally");
-        msg.type = RELEASE_ALL_AND_TERMINATE;
-        running = false;
-        msgsnd(my_pcb->msq_to_oss, &msg, msg_size, 0);
-        LOG("Sending TERMINATE");
-        return;
+    allocate(0, false);
+    attach();
+    layout_map();
+    if (shm->prefault)
+        prefault();
+
+    // Each process keeps its own log, named after its PCB
+    if (shm->log_min_level <= L_DEBUG) {
+        char path[16];
+        sprintf(path, "%d", pid);
+        log_open(path, L_DEBUG, LP_BLOCK);
     }
-    msg.type = IDLE;
-    msgsnd(my_pcb->msq_to_oss, &msg, msg_size, 0);
-    LOG("Sending IDLE");
-}
 
-void request()
-{
-    ipc_message msg;
-    msg._msgtyp = 0;
-    msg.type = REQUEST;
-    do {
-        msg.res_id = rand() % RESOURCE_NUM;
-        // Don't request a resource if we're already holding all of it
-    } while (allocated[msg.res_id] >= shm->resources[msg.res_id].limit);
-    msgsnd(my_pcb->msq_to_oss, &msg, msg_size, 0);
-    LOG("Sending REQUEST");
-}
-
-void release()
-{
-    ipc_message msg;
-    msg._msgtyp = 0;
-    msg.type = RELEASE;
-    int allocated_types = 0;
-    int to_release;
-    int rid;
-
-    for (int i = 0; i < RESOURCE_NUM; i++)
-        if (allocated[i] > 0)
-            allocated_types++;
-
-    if (allocated_types == 0) {
-        request();
-        return;
-    }
-    to_release = rand() % allocated_types + 1;
-
-    for (int i = 0; i <= RESOURCE_NUM; i++) {
-        if (allocated[i] > 0)
-            to_release--;
-        if (to_release == 0) {
-            rid = i;
-            break;
-        }
-    }
-
-    res_deallocate(rid);
-    msg.res_id = rid;
-    msgsnd(my_pcb->msq_to_oss, &msg, msg_size, 0);
-    LOG("Sending RELEASE");
+    if (!pool)
+        behaviour_init(&state, pid, seed);
 }
 
 void process()
 {
     ipc_message msg;
-    msg._msgtyp = 0;
-    LOG("Handling message");
-    // Check if terminating
-    if (osstime_cmp(&next_term, &shm->cpu_clock) <= 0) {
-        terminate();
-        osstime_advance(&next_term, rand() % 250);
-        return;
-    }
 
-    // Check if requesting/releasing resource
-    if (osstime_cmp(&next_res, &shm->cpu_clock) <= 0) {
-        if (rand() % 2) {
-            request();
-        } else {
-            release();
-        }
-        osstime_advance(&next_res, rand() % RES_INTERVAL);
-        return;
+    LOG("Handling message");
+    behaviour_step(&state, &msg);
+    switch (msg.type) {
+    case REQUEST:
+        LOG("Sending REQUEST");
+        break;
+    case RELEASE:
+        LOG("Sending RELEASE");
+        break;
+    case REQUEST_MANY:
+        LOG("Sending REQUEST_MANY for %d resources", msg.nitems);
+        break;
+    case RELEASE_MANY:
+        LOG("Sending RELEASE_MANY for %d resources", msg.nitems);
+        break;
+    case RELEASE_ALL_AND_TERMINATE:
+        LOG("Terminating normally");
+        if (!pool)
+            running = false;
+        LOG("Sending TERMINATE");
+        break;
+    default:
+        LOG("Sending IDLE");
     }
-    msg.type = IDLE;
-    msgsnd(my_pcb->msq_to_oss, &msg, msg_size, 0);
-    LOG("Sending IDLE");
+    channel_send(pid, TO_OSS, &msg);
 }
 
 void main_loop() {
@@ -171,8 +103,8 @@ void main_loop() {
 
     LOG("Main loop");
     // Get oss message
-    if (-1 == msgrcv(my_pcb->msq_to_user, &msg, msg_size, 0, 0) && errno == EINTR) {
-        // msgq disconnected
+    if (-1 == channel_recv(pid, TO_USER, &msg)) {
+        // Interrupted or channel removed
         running = false;
         return;
     }
@@ -184,13 +116,19 @@ void main_loop() {
         process();
         break;
     case ALLOCATE:
+    case ALLOCATE_MANY:
         LOG("Allocate");
-        res_allocate(msg.res_id);
+        behaviour_allocated(&state, &msg);
+        break;
+    case RESET:
+        LOG("Reset");
+        behaviour_free(&state);
+        behaviour_init(&state, pid, msg.seed);
         break;
     default:
         LOG("Terminate");
         msg.type = RELEASE_ALL_AND_TERMINATE;
-        msgsnd(my_pcb->msq_to_oss, &msg, msg_size, 0);
+        channel_send(pid, TO_OSS, &msg);
         running = false;
     }
 }
@@ -202,31 +140,26 @@ void deinit() {
 int main(int argc, char *argv[]) {
 
 	pid = atoi(argv[1]);
+    // oss passes the seed of our random numbers, or "pool" and the seeds come with RESET
+    if (argc > 2 && !strcmp(argv[2], "pool"))
+        pool = true;
+    else
+        seed = argc > 2 ? strtoul(argv[2], NULL, 10) : getpid();
 
     printf("Process %d started\n", pid);
 
-#ifdef DEBUG
-    log_file = fopen(argv[1], "w");
-#endif
     init();
 
-    start_time = shm->cpu_clock;
-    next_term = shm->cpu_clock;
-    osstime_advance(&next_term, 100000000);
-    next_res = shm->cpu_clock;
-    osstime_advance(&next_res, rand() % RES_INTERVAL);
-
     while(running) {
 		main_loop();
 		usleep(0);
 	}
 
 	deinit();
+    behaviour_free(&state);
 
     printf("Process %d terminated\n", pid);
 
-#ifdef DEBUG
-    fclose(log_file);
-#endif
+    log_close();
     return 0;
 }
@@ -0,0 +1,269 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "waitgraph.h"
+
+/* This module maintains the wait-for graph of simulated processes.
+ * Edges aren't stored explicitly: a blocked process waits on exactly one
+ * resource, so its successors are the holders of that resource, which
+ * oss keeps up to date as units are granted and released.
+ * oss updates the graph every time a process gets blocked or unblocked,
+ * and checks for a cycle only when edges are added.
+ *
+ * For detection on another thread (-d) wfg_snapshot() copies the edges into
+ * arrays of their own, which that thread searches while oss keeps changing
+ * the live graph. The search of the live graph and the one of the snapshot
+ * each have a Tarjan state of their own, so they can run at the same time.
+ */
+
+/* Resource each process is blocked on or -1 */
+static int *waits_on;
+
+/* Search state, marks are compared against current epoch so they don't need clearing */
+static uint *mark;
+static uint epoch;
+static int *parent;
+static int *stack;
+
+/* Tarjan's algorithm state */
+typedef struct {
+    int *scc_stack;
+    int *index_of;
+    int *lowlink;
+    bool *on_stack;
+    int *next_succ;
+    int *calls;
+} tarjan;
+
+/* One for the live graph and one for the snapshot */
+static tarjan live_search;
+static tarjan snap_search;
+
+/* Snapshot, successors of pid are snap_succ[snap_first[pid]] .. snap_succ[snap_first[pid + 1] - 1] */
+static int *snap_first;
+static int *snap_succ;
+static int snap_room;
+
+/* Allocates t for pcb_num processes, dropping what it had */
+static void tarjan_init(tarjan *t) {
+    free(t->scc_stack);
+    free(t->index_of);
+    free(t->lowlink);
+    free(t->on_stack);
+    free(t->next_succ);
+    free(t->calls);
+    t->scc_stack = malloc(pcb_num * sizeof(int));
+    t->index_of = malloc(pcb_num * sizeof(int));
+    t->lowlink = malloc(pcb_num * sizeof(int));
+    t->on_stack = malloc(pcb_num * sizeof(bool));
+    t->next_succ = malloc(pcb_num * sizeof(int));
+    t->calls = malloc(pcb_num * sizeof(int));
+}
+
+/* Sets up an empty graph of pcb_num processes, dropping the previous one */
+void wfg_init() {
+    free(waits_on);
+    free(mark);
+    free(parent);
+    free(stack);
+    free(snap_first);
+    free(snap_succ);
+    waits_on = malloc(pcb_num * sizeof(int));
+    mark = calloc(pcb_num, sizeof(uint));
+    parent = malloc(pcb_num * sizeof(int));
+    stack = malloc(pcb_num * sizeof(int));
+    tarjan_init(&live_search);
+    tarjan_init(&snap_search);
+    snap_first = calloc(pcb_num + 1, sizeof(int));
+    snap_succ = NULL;
+    snap_room = 0;
+    epoch = 0;
+    for (int i = 0; i < pcb_num; i++)
+        waits_on[i] = -1;
+}
+
+void wfg_block(int pid, int res_id) {
+    waits_on[pid] = res_id;
+}
+
+void wfg_unblock(int pid) {
+    waits_on[pid] = -1;
+}
+
+/* Looks for a cycle going through pid, which has just been blocked.
+ * Any cycle formed by the new edges has to pass through pid, so only the part
+ * of the graph reachable from it is searched.
+ * Returns number of processes in the cycle (written to cycle starting with pid)
+ * or 0 if there's none.
+ */
+int wfg_find_cycle(int pid, int *cycle) {
+    int top = 0;
+
+    if (waits_on[pid] == -1)
+        return 0;
+
+    if (++epoch == 0) {
+        memset(mark, 0, pcb_num * sizeof(uint));
+        epoch = 1;
+    }
+    mark[pid] = epoch;
+    stack[top++] = pid;
+
+    while (top > 0) {
+        int cur = stack[--top];
+        int res_id = waits_on[cur];
+        if (res_id == -1)
+            continue;
+        int cursor = 0, next;
+        while ((next = holder_next(res_id, &cursor)) != -1) {
+            if (next == cur)
+                continue;
+            if (next == pid) {
+                /* Walk back the parent links to report the cycle */
+                int len = 0;
+                for (int i = cur; i != pid; i = parent[i])
+                    len++;
+                cycle[0] = pid;
+                for (int i = cur, j = len; i != pid; i = parent[i], j--)
+                    cycle[j] = i;
+                return len + 1;
+            }
+            if (mark[next] == epoch)
+                continue;
+            mark[next] = epoch;
+            parent[next] = cur;
+            stack[top++] = next;
+        }
+    }
+    return 0;
+}
+
+/* Returns next successor of pid in the live graph or the snapshot or -1, cursor
+ * keeps the position among the holders of the resource pid waits on */
+static int successor(bool snapshot, int pid, int *cursor) {
+    int res_id, next;
+
+    if (snapshot) {
+        int i = snap_first[pid] + *cursor;
+        if (i == snap_first[pid + 1])
+            return -1;
+        (*cursor)++;
+        return snap_succ[i];
+    }
+
+    res_id = waits_on[pid];
+    if (res_id == -1)
+        return -1;
+    next = holder_next(res_id, cursor);
+    if (next == pid)
+        next = holder_next(res_id, cursor);
+    return next;
+}
+
+/* Tells if pid waits for anybody in the live graph or the snapshot */
+static bool waiting(bool snapshot, int pid) {
+    return snapshot ? snap_first[pid] != snap_first[pid + 1] : waits_on[pid] != -1;
+}
+
+/* Copies the edges of the live graph for wfg_snapshot_sets() */
+void wfg_snapshot() {
+    int n = 0;
+
+    for (int pid = 0; pid < pcb_num; pid++) {
+        int cursor = 0, next;
+        snap_first[pid] = n;
+        while ((next = successor(false, pid, &cursor)) != -1) {
+            if (n == snap_room) {
+                snap_room = snap_room ? 2 * snap_room : pcb_num;
+                snap_succ = realloc(snap_succ, snap_room * sizeof(int));
+            }
+            snap_succ[n++] = next;
+        }
+    }
+    snap_first[pcb_num] = n;
+}
+
+/* Finds all deadlocked sets of processes in a single pass, which are the strongly
+ * connected components of the graph with more than one process.
+ * Runs Tarjan's algorithm with an explicit call stack, so it takes O(V + E) time
+ * and no recursion.
+ * Members of set i are written to members[starts[i]] .. members[starts[i+1] - 1].
+ * Returns the number of sets found.
+ */
+static int deadlocked_sets(bool snapshot, int *members, int *starts) {
+    tarjan *t = snapshot ? &snap_search : &live_search;
+    int *scc_stack = t->scc_stack, *index_of = t->index_of, *lowlink = t->lowlink;
+    int *next_succ = t->next_succ, *calls = t->calls;
+    bool *on_stack = t->on_stack;
+    int counter = 0, top = 0, ncalls = 0;
+    int nsets = 0, nmembers = 0;
+
+    for (int i = 0; i < pcb_num; i++) {
+        index_of[i] = -1;
+        on_stack[i] = false;
+    }
+
+    for (int root = 0; root < pcb_num; root++) {
+        if (!waiting(snapshot, root) || index_of[root] != -1)
+            continue;
+
+        index_of[root] = lowlink[root] = counter++;
+        next_succ[root] = 0;
+        scc_stack[top++] = root;
+        on_stack[root] = true;
+        calls[ncalls++] = root;
+
+        while (ncalls > 0) {
+            int v = calls[ncalls - 1];
+            int w = successor(snapshot, v, &next_succ[v]);
+
+            if (w != -1) {
+                if (index_of[w] == -1) {
+                    /* Descend into w */
+                    index_of[w] = lowlink[w] = counter++;
+                    next_succ[w] = 0;
+                    scc_stack[top++] = w;
+                    on_stack[w] = true;
+                    calls[ncalls++] = w;
+                } else if (on_stack[w] && index_of[w] < lowlink[v]) {
+                    lowlink[v] = index_of[w];
+                }
+                continue;
+            }
+
+            /* All successors of v are done, return to the caller */
+            ncalls--;
+            if (ncalls > 0) {
+                int u = calls[ncalls - 1];
+                if (lowlink[v] < lowlink[u])
+                    lowlink[u] = lowlink[v];
+            }
+            if (lowlink[v] != index_of[v])
+                continue;
+
+            /* v is the root of a component, pop it off the stack */
+            int first = nmembers;
+            int w2;
+            do {
+                w2 = scc_stack[--top];
+                on_stack[w2] = false;
+                members[nmembers++] = w2;
+            } while (w2 != v);
+            if (nmembers - first > 1)
+                starts[nsets++] = first;
+            else
+                nmembers = first;
+        }
+    }
+    starts[nsets] = nmembers;
+    return nsets;
+}
+
+int wfg_deadlocked_sets(int *members, int *starts) {
+    return deadlocked_sets(false, members, starts);
+}
+
+/* Same on the last snapshot, which the caller may search on any thread */
+int wfg_snapshot_sets(int *members, int *starts) {
+    return deadlocked_sets(true, members, starts);
+}
@@ -0,0 +1,20 @@
+#ifndef WAITGRAPH_H
+#define WAITGRAPH_H
+
+#include <stdbool.h>
+
+#include "common.h"
+
+/* Wait-for graph kept up to date by oss as processes get blocked.
+ * There's an edge P -> Q whenever P is blocked on a resource Q holds.
+ */
+
+void wfg_init();
+void wfg_block(int pid, int res_id);
+void wfg_unblock(int pid);
+int wfg_find_cycle(int pid, int *cycle);
+int wfg_deadlocked_sets(int *members, int *starts);
+void wfg_snapshot();
+int wfg_snapshot_sets(int *members, int *starts);
+
+#endif
@@ -0,0 +1,62 @@
+#include "waitq.h"
+
+/* Wait queues are linked lists threaded through the PCBs in shared memory.
+ * Every PCB waits on at most one resource, so the links in its PCB are all
+ * the space a queue ever needs, however many resources there are.
+ */
+
+void waitq_init(waitq *q) {
+    q->head = -1;
+    q->tail = -1;
+    q->count = 0;
+}
+
+/* Puts pid behind every entry with a key at least as high.
+ * With equal keys that's a plain FIFO append.
+ */
+void waitq_push(waitq *q, int pid, int key) {
+    int prev = q->tail;
+
+    while (prev != -1 && pcbs[prev].wq_key < key)
+        prev = pcbs[prev].wq_prev;
+
+    pcbs[pid].wq_key = key;
+    pcbs[pid].wq_prev = prev;
+    pcbs[pid].wq_next = prev == -1 ? q->head : pcbs[prev].wq_next;
+    if (prev == -1)
+        q->head = pid;
+    else
+        pcbs[prev].wq_next = pid;
+    if (pcbs[pid].wq_next == -1)
+        q->tail = pid;
+    else
+        pcbs[pcbs[pid].wq_next].wq_prev = pid;
+    q->count++;
+}
+
+/* Returns the first pid in the queue or -1 if it's empty */
+int waitq_peek(waitq *q) {
+    return q->head;
+}
+
+/* Returns the pid queued after pid or -1 */
+int waitq_next(int pid) {
+    return pcbs[pid].wq_next;
+}
+
+/* Removes pid, which has to be in the queue */
+void waitq_remove(waitq *q, int pid) {
+    int prev = pcbs[pid].wq_prev;
+    int next = pcbs[pid].wq_next;
+
+    if (prev == -1)
+        q->head = next;
+    else
+        pcbs[prev].wq_next = next;
+    if (next == -1)
+        q->tail = prev;
+    else
+        pcbs[next].wq_prev = prev;
+    pcbs[pid].wq_prev = pcbs[pid].wq_next = -1;
+    q->count--;
+}
@@ -0,0 +1,14 @@
+#ifndef WAITQ_H
+#define WAITQ_H
+
+#include <stdbool.h>
+
+#include "common.h"
+
+void waitq_init(waitq *q);
+void waitq_push(waitq *q, int pid, int key);
+int waitq_peek(waitq *q);
+int waitq_next(int pid);
+void waitq_remove(waitq *q, int pid);
+
+#endif